@@ -0,0 +1,107 @@
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+
+#include "../src/lexer.h"
+
+using namespace std;
+
+// Keyword lookup benchmark :
+/*
+	Classifies the same words with the lexer's perfect hash and with the chain
+	of string comparisons it replaced. The words are mostly identifiers, as in
+	real programs, and are run once in a random order and once sorted, so a
+	lookup whose cost depends on the word (or on predicting which word comes
+	next) shows up as a difference between the two.
+
+	g++ -std=c++17 -O2 -o keywords bench/keywords.cpp && ./keywords
+*/
+
+TOKEN_TYPE chainLookup(string_view text) { // checkIfKeyword as it was before the hash
+	if (text == "INT") return INT;
+	else if (text == "FLOAT") return FLOAT;
+	else if (text == "TEXT") return TEXT;
+	else if (text == "IF") return IF;
+	else if (text == "THEN") return THEN;
+	else if (text == "ELSE") return ELSE;
+	else if (text == "ENDIF") return ENDIF;
+	else if (text == "WHILE") return WHILE;
+	else if (text == "DO") return DO;
+	else if (text == "ENDWHILE") return ENDWHILE;
+	else if (text == "LABEL") return LABEL;
+	else if (text == "GOTO") return GOTO;
+	else if (text == "PRINT") return PRINT;
+	else if (text == "FUNC") return FUNC;
+	else if (text == "IS") return IS;
+	else if (text == "WITH") return WITH;
+	else if (text == "USING") return USING;
+	else if (text == "ENDFUNC") return ENDFUNC;
+	else return INVALID;
+}
+
+volatile long sink; // the lookups' results go here so they aren't optimized away
+
+// Nanoseconds per word for lookup over every word, best of a few runs
+template <typename Lookup>
+double timeLookups(const vector<string_view>& words, Lookup lookup) {
+	double best = 1e30;
+
+	for (int run = 0; run < 5; run++) {
+		auto start = chrono::steady_clock::now();
+		long sum = 0;
+		for (string_view word : words) sum += lookup(word);
+		auto end = chrono::steady_clock::now();
+
+		sink = sum;
+		best = min(best, chrono::duration<double, nano>(end - start).count() / words.size());
+	}
+	return best;
+}
+
+int main() {
+	const int COUNT = 4000000;
+	mt19937 random(12345);
+
+	vector<string> pool; // identifiers of the kind programs use, some sharing a keyword's first letter or length
+	const char* identifiers[] = {"x", "i", "n", "sum", "total", "index", "IFFY", "DONE", "count", "value", "ENDING", "limit", "Gx", "Tx", "WITHIN", "temp"};
+	for (const char* identifier : identifiers) pool.push_back(identifier);
+	for (int i = 0; i < 64; i++) pool.push_back("v" + to_string(i));
+	int identifierCount = pool.size();
+	for (const Keyword& keyword : KEYWORDS) pool.push_back(string(keyword.text));
+
+	vector<string_view> words;
+	words.reserve(COUNT);
+	for (int i = 0; i < COUNT; i++) { // three in four words are identifiers
+		if (random() % 4 != 0) words.push_back(pool[random() % identifierCount]);
+		else words.push_back(pool[identifierCount + random() % (pool.size() - identifierCount)]);
+	}
+
+	for (string_view word : words) {
+		if (chainLookup(word) != Token().checkIfKeyword(word)) {
+			cerr << "Lookups disagree on " << word << endl;
+			return 1;
+		}
+	}
+
+	vector<string_view> sorted = words;
+	sort(sorted.begin(), sorted.end());
+
+	auto hash = [](string_view word) { return (int) Token().checkIfKeyword(word); };
+	auto chain = [](string_view word) { return (int) chainLookup(word); };
+
+	cout << "ns per word     random   sorted\n";
+	cout << "perfect hash    " << timeLookups(words, hash) << "\t " << timeLookups(sorted, hash) << "\n";
+	cout << "compare chain   " << timeLookups(words, chain) << "\t " << timeLookups(sorted, chain) << "\n";
+
+	cout << "\nns per word by keyword position in the chain\n";
+	for (const char* text : {"INT", "DO", "ENDFUNC", "identifier"}) {
+		vector<string_view> same(COUNT / 4, text);
+		cout << "  " << text << "\thash " << timeLookups(same, hash) << "\tchain " << timeLookups(same, chain) << "\n";
+	}
+
+	return 0;
+}
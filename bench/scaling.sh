@@ -0,0 +1,39 @@
+#!/bin/sh
+# Times the compiler on generated programs with 1k, 10k and 100k variables,
+# string literals and functions. Each declaration, lookup and literal goes
+# through the hash tables, so the time per symbol should stay about the same
+# as the count grows; the linear scans they replaced made it grow with it.
+#
+# usage: bench/scaling.sh        (CXX picks the compiler, g++ by default)
+
+BENCH=$(cd "$(dirname "$0")" && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+${CXX:-g++} -std=c++17 -O2 -o "$WORK/compiler" "$BENCH/../src/main.cpp" || exit 1
+
+# generate <n> <file>: n variables each read back, n different literals and n / 10 functions, each called
+generate() {
+	awk -v n="$1" 'BEGIN {
+		for (i = 0; i < n; i++) printf "INT v%d = %d\n", i, i
+		for (i = 1; i < n; i++) printf "v%d = v%d + v%d\n", i, i - 1, i
+		for (i = 0; i < n; i++) printf "PRINT \"literal %d\"\n", i
+		for (i = 0; i < n / 10; i++) printf "FUNC f%d IS\n\tv%d = %d\nENDFUNC\n", i, i, i
+		for (i = 0; i < n / 10; i++) printf "DO f%d\n", i
+	}' > "$2"
+}
+
+# seconds <command...>: wall time of the command
+seconds() {
+	start=$(date +%s.%N)
+	"$@" > /dev/null || echo "failed: $*" >&2
+	end=$(date +%s.%N)
+	echo "$start $end" | awk '{ printf "%.3f", $2 - $1 }'
+}
+
+printf "%8s %10s %16s\n" symbols seconds "us per symbol"
+for n in 1000 10000 100000; do
+	generate $n "$WORK/p$n.sim"
+	time=$(cd "$WORK" && seconds ./compiler "p$n.sim" "p$n.s")
+	printf "%8d %10s %16s\n" $n "$time" "$(echo "$time $n" | awk '{ printf "%.2f", $1 * 1000000 / $2 }')"
+done
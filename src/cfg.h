@@ -0,0 +1,397 @@
+#include <vector>
+#include <string>
+
+#include "instr.h"
+#include "nametable.h"
+#include "trace.h"
+
+#ifndef CFG_H
+#define CFG_H
+using namespace std;
+
+// Basic block :
+/*
+	A run of instructions that's only entered at the top, through its labels,
+	and only left at the bottom. Blocks index into the instruction list they
+	were built from.
+*/
+struct BasicBlock {
+	size_t begin;	// first instruction, its labels included
+	size_t end;
+	int label;	// a label jumping to the block can use, -1 when it has none
+	int fallsThrough;	// 1 when the last instruction can run on into the next block
+};
+
+// Control flow graph :
+/*
+	Rearranges the branches in an instruction list once the code generator
+	and peephole optimizer are done with it. The list is split into basic
+	blocks, then:
+
+	- jumps to a block that only jumps somewhere else go straight there, and
+	  a branch over a lone b to the block after it becomes the inverse branch
+	- loops are rotated: the b at the bottom of a loop is replaced by a copy
+	  of the test at the top (when the test is small), so each iteration runs
+	  one conditional branch back instead of a b and a test that falls through
+	- blocks are laid out so that a b is followed by its target wherever that
+	  target isn't already reached by falling into it, and the branches that
+	  leave only point at the next block are dropped
+	- a conditional branch that ended up too far from its target (tbz only
+	  reaches 32KB) becomes the inverse branch over a b
+
+	The first and last block stay where they are: lists start at a function's
+	label or carry on from the last list, and end in the literal pool or fall
+	into the next list.
+*/
+class ControlFlowGraph {
+	public:
+		ControlFlowGraph(NameTable& labelTable);
+		void optimize(vector<Instr>& code);
+		void build(vector<Instr>& code);
+		void thread(vector<Instr>& code);
+		void rotate(vector<Instr>& code);
+		void skipJumps(vector<Instr>& code);
+		void layout(vector<Instr>& code);
+		void relax(vector<Instr>& code);
+		int destination(vector<Instr>& code, int label);
+		int blockLabel(int block, vector<int>& added);
+		int terminator(vector<Instr>& code, int block);
+		size_t body(vector<Instr>& code, int block);
+		void report();
+
+		static const size_t ROTATE_LIMIT = 12;	// longest loop test that's copied to the bottom
+		static const int THREAD_LIMIT = 8;	// jumps followed, so a loop of them can't hang it
+
+		NameTable& labels;
+		vector<BasicBlock> blocks;
+		vector<int> labelBlocks;	// block each label starts, -1 for labels in other lists
+		vector<int> listed;	// labels set in labelBlocks for this list, put back to -1 for the next
+		int created;	// labels added for blocks that didn't have one
+
+		long long threaded;
+		long long rotated;
+		long long dropped;
+};
+
+ControlFlowGraph::ControlFlowGraph(NameTable& labelTable) : labels(labelTable) {
+	created = 0;
+	threaded = 0;
+	rotated = 0;
+	dropped = 0;
+}
+
+void ControlFlowGraph::optimize(vector<Instr>& code) {
+	build(code);
+	thread(code);
+	rotate(code);
+	skipJumps(code);
+	layout(code);
+	relax(code);
+}
+
+// Splits the list into blocks at labels and after branches
+void ControlFlowGraph::build(vector<Instr>& code) {
+	blocks.clear();
+	for (int label : listed) labelBlocks[label] = -1; // not the whole table, that's as big as the program
+	listed.clear();
+	labelBlocks.resize(labels.size(), -1);
+
+	size_t i = 0;
+	while (i < code.size()) {
+		BasicBlock block = {i, i, -1, 1};
+
+		for (; i < code.size() && code[i].op == OP_LABEL; i++) {
+			labelBlocks[code[i].label] = blocks.size();
+			listed.push_back(code[i].label);
+			if (block.label == -1) block.label = code[i].label;
+		}
+
+		while (i < code.size() && code[i].op != OP_LABEL) {
+			if (isBranch(code[i++].op)) break;
+		}
+
+		block.end = i;
+		if (block.end > block.begin && (code[i - 1].op == OP_B || code[i - 1].op == OP_RET)) block.fallsThrough = 0;
+		blocks.push_back(block);
+	}
+}
+
+// First instruction of a block after its labels
+size_t ControlFlowGraph::body(vector<Instr>& code, int block) {
+	size_t i = blocks[block].begin;
+	while (i < blocks[block].end && code[i].op == OP_LABEL) i++;
+	return i;
+}
+
+// Index of the branch or ret ending block, -1 when it just runs into the next one
+int ControlFlowGraph::terminator(vector<Instr>& code, int block) {
+	if (blocks[block].end == body(code, block)) return -1;
+
+	size_t last = blocks[block].end - 1;
+	if (isBranch(code[last].op)) return last;
+	return -1;
+}
+
+// Where a jump to label really ends up, skipping blocks that are empty or only jump on
+int ControlFlowGraph::destination(vector<Instr>& code, int label) {
+	for (int hops = 0; hops < THREAD_LIMIT; hops++) {
+		int block = labelBlocks[label];
+		if (block == -1) return label; // in another list
+
+		size_t first = body(code, block);
+
+		if (first == blocks[block].end) { // only labels, the jump carries on into the next block
+			if (block + 1 >= (int) blocks.size() || blocks[block + 1].label == -1) return label;
+			label = blocks[block + 1].label;
+		} else if (code[first].op == OP_B) {
+			label = code[first].label;
+		} else {
+			return label;
+		}
+	}
+	return label;
+}
+
+void ControlFlowGraph::thread(vector<Instr>& code) {
+	for (Instr& instr : code) {
+		if (instr.op != OP_B && !isConditionalBranch(instr.op)) continue;
+
+		int label = destination(code, instr.label);
+		if (instr.op != OP_B && labelBlocks[label] == -1) continue; // conditional branches don't reach far, keep them in the list
+
+		if (label != instr.label) {
+			instr.label = label;
+			threaded++;
+		}
+	}
+}
+
+// Label for a block, made up when it has none. Made up labels are placed by layout
+int ControlFlowGraph::blockLabel(int block, vector<int>& added) {
+	if (blocks[block].label != -1) return blocks[block].label;
+
+	int label = labels.insert("BLOCK" + to_string(created++));
+	labelBlocks.resize(labels.size(), -1);
+	labelBlocks[label] = block;
+	listed.push_back(label);
+	blocks[block].label = label;
+	added[block] = label;
+	return label;
+}
+
+// Replaces a b back to a small loop test with a copy of the test, branching back to the loop body
+void ControlFlowGraph::rotate(vector<Instr>& code) {
+	vector<int> added(blocks.size(), -1);
+	vector<int> header(blocks.size(), -1); // loop test each block's b back is replaced with
+	int found = 0;
+
+	for (int block = 0; block < (int) blocks.size(); block++) {
+		int last = terminator(code, block);
+		if (last == -1 || code[last].op != OP_B) continue;
+
+		int test = labelBlocks[code[last].label];
+		if (test == -1 || test > block || test + 1 >= (int) blocks.size()) continue; // only loops, back to this list
+
+		int end = terminator(code, test);
+		size_t size = blocks[test].end - body(code, test);
+		if (end == -1 || !isConditionalBranch(code[end].op) || size > ROTATE_LIMIT) continue;
+
+		header[block] = test;
+		blockLabel(test + 1, added);
+		found = 1;
+	}
+
+	if (!found) return;
+
+	vector<Instr> rotatedCode;
+	rotatedCode.reserve(code.size());
+
+	for (int block = 0; block < (int) blocks.size(); block++) {
+		if (added[block] != -1) rotatedCode.push_back(makeLabelInstr(OP_LABEL, added[block]));
+
+		size_t end = blocks[block].end;
+		if (header[block] != -1) end--; // the b back
+
+		for (size_t i = blocks[block].begin; i < end; i++) rotatedCode.push_back(code[i]);
+
+		if (header[block] != -1) {
+			int test = header[block];
+			for (size_t i = body(code, test); i < blocks[test].end; i++) rotatedCode.push_back(code[i]);
+			rotatedCode.push_back(makeLabelInstr(OP_B, blocks[test + 1].label)); // test passed, back into the body
+			rotated++;
+		}
+	}
+
+	code.swap(rotatedCode);
+	build(code);
+}
+
+// b.cond over a lone b to the block after it: b.(not cond) straight to where the b went
+void ControlFlowGraph::skipJumps(vector<Instr>& code) {
+	int changed = 0;
+
+	for (int block = 0; block + 2 < (int) blocks.size(); block++) {
+		int last = terminator(code, block);
+		if (last == -1 || !isConditionalBranch(code[last].op)) continue;
+
+		BasicBlock& jump = blocks[block + 1];
+		if (jump.label != -1 || jump.end - jump.begin != 1 || code[jump.begin].op != OP_B) continue;
+		if (labelBlocks[code[last].label] != block + 2) continue;
+
+		invertBranch(code[last]);
+		code[last].label = code[jump.begin].label;
+		code[jump.begin].op = OP_NOP;
+		dropped++;
+		changed = 1;
+	}
+
+	if (!changed) return;
+
+	size_t kept = 0;
+	for (size_t i = 0; i < code.size(); i++) {
+		if (code[i].op != OP_NOP) code[kept++] = code[i];
+	}
+	code.resize(kept);
+	build(code);
+}
+
+// Orders the blocks so jumps become fall throughs, then fixes up the branches for the new order
+void ControlFlowGraph::layout(vector<Instr>& code) {
+	int count = blocks.size();
+	if (count < 3) return;
+
+	int pinned = count - 1;
+	vector<char> placed(count, 0);
+	vector<int> order;
+	order.reserve(count);
+
+	for (int block = 1; block < pinned; block++) { // nothing can reach a block with no label that nothing falls into
+		if (blocks[block].label == -1 && !blocks[block - 1].fallsThrough) {
+			placed[block] = 1;
+			dropped += blocks[block].end - blocks[block].begin;
+		}
+	}
+
+	int scan = 1;
+	for (int block = 0; block != -1;) {
+		placed[block] = 1;
+		order.push_back(block);
+
+		int last = terminator(code, block);
+		int next = -1;
+
+		if (last != -1 && code[last].op == OP_B) { // pull the target up, unless something already falls into it
+			int target = labelBlocks[code[last].label];
+			if (target > 0 && target != pinned && !placed[target] && !blocks[target - 1].fallsThrough) next = target;
+		} else if (blocks[block].fallsThrough && block + 1 != pinned && !placed[block + 1]) {
+			next = block + 1;
+		}
+
+		if (next == -1) {
+			while (scan < pinned && placed[scan]) scan++;
+			if (scan < pinned) next = scan;
+		}
+		block = next;
+	}
+	order.push_back(pinned);
+
+	vector<int> added(count, -1);
+	vector<char> dropLast(count, 0);
+	vector<int> jumpAfter(count, -1); // label of a b to add at the end of the block
+
+	for (int position = 0; position < (int) order.size(); position++) {
+		int block = order[position];
+		int next = (position + 1 < (int) order.size()) ? order[position + 1] : -1;
+		int last = terminator(code, block);
+
+		int target = (last != -1 && code[last].op != OP_RET) ? labelBlocks[code[last].label] : -1; // -1 for a label in another list, which never follows
+
+		if (last != -1 && code[last].op == OP_B) {
+			if (target != -1 && target == next) dropLast[block] = 1;
+			continue;
+		}
+
+		if (!blocks[block].fallsThrough || block + 1 >= count || block + 1 == next) continue;
+
+		if (last != -1 && isConditionalBranch(code[last].op) && target != -1 && target == next) { // the branch target follows, so branch to the other side
+			invertBranch(code[last]);
+			code[last].label = blockLabel(block + 1, added);
+		} else {
+			jumpAfter[block] = blockLabel(block + 1, added);
+		}
+	}
+
+	vector<Instr> laidOut;
+	laidOut.reserve(code.size() + count);
+
+	for (int block : order) {
+		if (added[block] != -1) laidOut.push_back(makeLabelInstr(OP_LABEL, added[block]));
+
+		size_t end = blocks[block].end - dropLast[block];
+		for (size_t i = blocks[block].begin; i < end; i++) laidOut.push_back(code[i]);
+
+		if (dropLast[block]) dropped++;
+		if (jumpAfter[block] != -1) {
+			laidOut.push_back(makeLabelInstr(OP_B, jumpAfter[block]));
+			dropped--;
+		}
+	}
+
+	code.swap(laidOut);
+}
+
+void ControlFlowGraph::relax(vector<Instr>& code) {
+	if ((long long) code.size() * 4 < branchRange(OP_TBZ)) return; // everything is in reach
+
+	for (;;) { // moving targets further away can put other branches out of reach
+		vector<long long> where(labels.size(), -1);
+		vector<long long> at(code.size());
+		long long offset = 0;
+
+		for (size_t i = 0; i < code.size(); i++) {
+			at[i] = offset;
+			if (code[i].op == OP_LABEL) where[code[i].label] = offset;
+			else if (code[i].op != OP_NOP) offset += 4;
+		}
+
+		vector<char> far(code.size(), 0);
+		int found = 0;
+
+		for (size_t i = 0; i < code.size(); i++) {
+			if (!isConditionalBranch(code[i].op) || where[code[i].label] == -1) continue;
+
+			long long distance = where[code[i].label] - at[i];
+			if (distance < 0) distance = -distance;
+			if (distance >= branchRange(code[i].op)) far[i] = found = 1;
+		}
+
+		if (!found) return;
+
+		vector<Instr> relaxed;
+		relaxed.reserve(code.size() + 16);
+
+		for (size_t i = 0; i < code.size(); i++) {
+			if (!far[i]) {
+				relaxed.push_back(code[i]);
+				continue;
+			}
+
+			int skip = labels.insert("BLOCK" + to_string(created++));
+			Instr branch = code[i];
+			invertBranch(branch);
+			branch.label = skip;
+
+			relaxed.push_back(branch);
+			relaxed.push_back(makeLabelInstr(OP_B, code[i].label));
+			relaxed.push_back(makeLabelInstr(OP_LABEL, skip));
+		}
+		code.swap(relaxed);
+	}
+}
+
+// Counts for -v
+void ControlFlowGraph::report() {
+	TRACE(TRACE_STATUS, "cfg: " << threaded << " jumps threaded, " << rotated << " loops rotated, " << dropped << " instructions dropped" << endl);
+}
+
+#endif
@@ -0,0 +1,883 @@
+#include <string>
+#include <string_view>
+
+#include "ir.h"
+#include "emitter.h"
+#include "regalloc.h"
+#include "immediate.h"
+#include "divide.h"
+#include "instr.h"
+#include "peephole.h"
+#include "cfg.h"
+#include "runtime.h"
+
+#ifndef CODEGEN_H
+#define CODEGEN_H
+using namespace std;
+
+// Code generator :
+/*
+	Lowers the IR built by the Parser into ARM64 instructions, which go through
+	the Peephole optimizer on their way to the Emitter. Expressions are
+	numbered Sethi-Ullman style and evaluated into temporaries x9 - x15 taken
+	from a pool, the side needing more registers first, with each instruction
+	writing its result straight into one of its operands' registers. x8 - x15
+	are only used inside a statement and never hold anything across a label or
+	a branch, which is what lets the peephole optimizer drop their dead values.
+	Function bodies are lowered where their FUNC statement appears, into the
+	functions section, and address their parameters and locals from fp. While
+	an outermost WHILE loop runs, the variables the RegisterAllocator picked
+	for it live in x19 - x28 instead of memory.
+*/
+class CodeGenerator {
+	public:
+		CodeGenerator(IrProgram& inputIr, Emitter& inputEmitter);
+		void program();
+		void block(int id);
+		void statement(int id);
+		void function(int id);
+		int expression(int id);
+		int countNeeds(int id);
+		int evaluate(int id);
+		void operandPair(int left, int right, int& a, int& b);
+		int destination(int a, int b);
+		int inRegister(int id);
+		int immediateOperand(int id);
+		int constantDivisor(int id);
+		int divideByConstant(int id);
+		void constant(int reg, long long value);
+		void condition(int id, int exitLabel);
+		void operands(int id, int& left, int& right, IR_OP& op);
+		CONDITION compare(int id);
+		int select(int id);
+		int cheap(int id, int& budget);
+		int sameValue(int a, int b);
+		int increments(int id);
+		void assign(int id, int value);
+		void add(const Instr& instr);
+		void placeLabel(int label);
+		int label(string_view name);
+		void flush(InstrList& list);
+		void loadRegisters();
+		void storeRegisters();
+		void moveRegister(int i, OPCODE op);
+		void adjustStack(OPCODE op, int bytes);
+
+		static const int SELECT_LIMIT = 6; // nodes in both values of an IF turned into a csel
+		static const size_t FLUSH_SIZE = 64 * 1024; // instructions the main code holds before it's optimized and emitted
+
+		IrProgram& ir;
+		Emitter& emitter;
+		RegisterAllocator allocator;
+		LoopRegisters loop;	// registers of the loop being lowered, empty outside of loops
+		TemporaryRegisters temps;
+		vector<int> needs;	// registers each expression node needs, from countNeeds()
+
+		NameTable labels;	// every label in the output. Members are built in this order, and the ones below are built with it
+		Peephole peephole;
+		ControlFlowGraph graph;
+		Runtime runtime;
+		InstrList code;
+		InstrList functionCode;
+
+		int currentFunction;	// id of the function being lowered, -1 outside of functions
+		int ifCount;
+		int whileCount;
+		int loopDepth;	// WHILE loops around the code being lowered
+};
+
+CodeGenerator::CodeGenerator(IrProgram& inputIr, Emitter& inputEmitter) : ir(inputIr), emitter(inputEmitter), allocator(inputIr), graph(labels), runtime(labels), code(labels), functionCode(labels) {
+	currentFunction = -1;
+	ifCount = 0;
+	whileCount = 0;
+	loopDepth = 0;
+	emitter.object.labels = &labels;
+}
+
+// Adds an instruction to the section being generated
+void CodeGenerator::add(const Instr& instr) {
+	if (currentFunction != -1) functionCode.add(instr);
+	else code.add(instr);
+}
+
+int CodeGenerator::label(string_view name) {
+	return labels.insert(name);
+}
+
+void CodeGenerator::placeLabel(int label) {
+	add(makeLabelInstr(OP_LABEL, label));
+}
+
+// Optimizes the list, sends it to its section and empties it
+void CodeGenerator::flush(InstrList& list) {
+	peephole.run(list.instrs);
+	graph.optimize(list.instrs);
+
+	if (emitter.binary) {
+		emitter.instructions(list.instrs, &list == &functionCode ? PART_FUNCTIONS : PART_CODE);
+		list.clear();
+		return;
+	}
+
+	string text;
+	for (const Instr& instr : list.instrs) {
+		text.clear();
+		list.renderInstr(instr, text);
+
+		if (&list == &functionCode) emitter.functionLine(text);
+		else emitter.emitLine(text);
+	}
+	list.clear();
+}
+
+// Loads or stores the variable kept in register i of the current loop
+void CodeGenerator::moveRegister(int i, OPCODE op) {
+	int reg = FIRST_SAVED_REGISTER + i;
+
+	if (loop.isLocal(i)) {
+		int offset = ir.functionMap.scopes[currentFunction].getLocalOffset(loop.symbols[i] - loop.firstLocal);
+		add(makeMemoryInstr(op, reg, REG_FP, offset));
+		return;
+	}
+
+	int address = temps.take();
+	add(makeLabelInstr(OP_ADR, label(ir.symbolMap.getLabel(loop.symbols[i])), address));
+	add(makeMemoryInstr(op, reg, address, 0));
+	temps.release(address);
+}
+
+// add or sub bytes to sp, going through x9 when it doesn't fit an immediate
+void CodeGenerator::adjustStack(OPCODE op, int bytes) {
+	if (bytes == 0) return;
+
+	if (bytes < 4096) {
+		add(makeInstr(op == OP_ADD ? OP_ADD_IMM : OP_SUB_IMM, REG_SP, REG_SP, -1, bytes));
+		return;
+	}
+
+	vector<Instr> load;
+	immediateInstrs(9, bytes, load);
+	for (Instr& instr : load) add(instr);
+	add(makeInstr(op, REG_SP, REG_SP, 9));
+}
+
+void CodeGenerator::loadRegisters() {
+	for (int i = 0; i < (int) loop.symbols.size(); i++) moveRegister(i, OP_LDR);
+}
+
+// Brings memory up to date with every register the loop has assigned
+void CodeGenerator::storeRegisters() {
+	for (int i = 0; i < (int) loop.symbols.size(); i++) {
+		if (loop.written[i]) moveRegister(i, OP_STR);
+	}
+}
+
+void CodeGenerator::program() {
+	emitter.entry("_start");
+
+	needs.assign(ir.nodes.size(), 0);
+
+	for (int id = ir.main; id != -1; id = ir.node(id).next) {
+		statement(id);
+		if (code.size() >= FLUSH_SIZE) flush(code); // scratch registers are dead between statements
+	}
+
+	for (int i = 0; i < ir.symbolMap.size(); i++) { // only what the code refers to, dead code may have been all that used the rest
+		if (labels.find(ir.symbolMap.getLabel(i)) == -1) continue;
+		emitter.quad(ir.symbolMap.getLabel(i));
+	}
+
+	for (int i = 0; i < ir.stringLiterals.size(); i++) {
+		string label = "S" + to_string(i);
+		if (labels.find(label) == -1) continue;
+
+		emitter.ascii(label, ir.stringLiterals.names[i], 1);
+		emitter.length(label);
+	}
+
+	if (runtime.used) add(makeLabelInstr(OP_BL, runtime.call("RFLUSH"))); // whatever is still in the output buffer
+	add(makeInstr(OP_MOVZ, 8, -1, -1, 93));
+	add(makeInstr(OP_MOVZ, 0, -1, -1, 0));
+	add(makeInstr(OP_SVC, -1, -1, -1, 0));
+	add(makeInstr(OP_LTORG)); // literal pool for any ldr =, out of the way of the code
+	flush(code);
+
+	runtime.generate(functionCode.instrs);
+	flush(functionCode);
+	runtime.data(emitter);
+
+	peephole.report();
+	graph.report();
+}
+
+// Lowers every statement chained from id
+void CodeGenerator::block(int id) {
+	for (; id != -1; id = ir.node(id).next) {
+		statement(id);
+	}
+}
+
+void CodeGenerator::statement(int id) {
+	IrNode& node = ir.node(id);
+
+	switch (node.op) {
+		case IR_PRINT: {
+			string index = to_string(node.a);
+
+			add(makeLabelInstr(OP_ADR, label("S" + index), 1));
+			add(makeLabelInstr(OP_LDR_LITERAL, label("S" + index + "_len"), 2));
+			add(makeLabelInstr(OP_BL, runtime.call("RPRINT")));
+			break;
+		}
+		case IR_PRINT_VALUE: {
+			int value = expression(node.a);
+			add(makeInstr(OP_MOV, 0, value));
+			temps.release(value);
+			add(makeLabelInstr(OP_BL, runtime.call("RPRINT_NUMBER")));
+			break;
+		}
+		case IR_IF: {
+			if (select(id)) break;
+
+			string count = to_string(ifCount++); // numbered before the body, so nested IFs get their own labels
+			int ifLabel = label("XIF" + count);
+			int elseLabel = label("XELSE" + count);
+
+			condition(node.a, ifLabel);
+			block(node.b);
+			add(makeLabelInstr(OP_B, elseLabel));
+
+			placeLabel(ifLabel);
+			block(node.c);
+			placeLabel(elseLabel);
+			break;
+		}
+		case IR_WHILE: {
+			string count = to_string(whileCount++);
+			int startLabel = label("SWHILE" + count);
+			int exitLabel = label("XWHILE" + count);
+			int outermost = loop.empty();
+
+			if (outermost) {
+				loop = allocator.allocate(id, currentFunction);
+				loadRegisters();
+			}
+
+			placeLabel(startLabel);
+			loopDepth++;
+			condition(node.a, exitLabel);
+			block(node.b);
+			loopDepth--;
+
+			add(makeLabelInstr(OP_B, startLabel));
+			placeLabel(exitLabel);
+
+			if (outermost) {
+				storeRegisters();
+				loop = LoopRegisters();
+			}
+			break;
+		}
+		case IR_LABEL: // a GOTO gets here with only memory up to date
+			storeRegisters();
+			placeLabel(label("L" + ir.labels.names[node.a]));
+			loadRegisters();
+			break;
+		case IR_GOTO:
+			storeRegisters();
+			add(makeLabelInstr(OP_B, label("L" + ir.labels.names[node.a])));
+			break;
+		case IR_ASSIGN:
+		case IR_ASSIGN_LOCAL: {
+			int value = expression(node.b);
+			assign(id, value);
+			temps.release(value);
+			break;
+		}
+		case IR_CALL: { // the first eight arguments go in x0 - x7, the rest on the stack
+			int stacked = max(node.c - ARGUMENT_REGISTERS, 0);
+			int area = (stacked * 8 + 15) & ~15; // stack always has to be 16 aligned
+
+			adjustStack(OP_SUB, area);
+
+			int index = 0;
+			for (int arg = node.b; arg != -1; arg = ir.node(arg).next, index++) {
+				int value = expression(arg); // expressions never touch x0 - x7, so earlier arguments stay put
+
+				if (index < ARGUMENT_REGISTERS) add(makeInstr(OP_MOV, index, value));
+				else add(makeMemoryInstr(OP_STR, value, REG_SP, (index - ARGUMENT_REGISTERS) * 8));
+				temps.release(value);
+			}
+
+			for (int i = 0; i < (int) loop.symbols.size(); i++) { // the callee sees the globals in memory
+				// one it writes is reloaded after the call, so it has to be stored even if it isn't read: the write may not happen
+				int used = allocator.reads(node.a, loop.symbols[i]) || allocator.writes(node.a, loop.symbols[i]);
+				if (!loop.isLocal(i) && loop.written[i] && used) moveRegister(i, OP_STR);
+			}
+
+			add(makeLabelInstr(OP_BL, label(ir.functionMap.getLabel(node.a))));
+			adjustStack(OP_ADD, area);
+
+			for (int i = 0; i < (int) loop.symbols.size(); i++) {
+				if (!loop.isLocal(i) && allocator.writes(node.a, loop.symbols[i])) moveRegister(i, OP_LDR);
+			}
+			break;
+		}
+		case IR_FUNC: { // a function defined inside a loop doesn't share its registers
+			LoopRegisters outer = loop;
+			int outerDepth = loopDepth;
+			loop = LoopRegisters();
+			loopDepth = 0;
+
+			function(id);
+
+			loop = outer;
+			loopDepth = outerDepth;
+			break;
+		}
+		default:
+			emitter.abort("Unexpected IR node in a block");
+	}
+}
+
+// Frame, from the top: locals, the parameters that came in registers, then the
+// saved fp and lr, which fp points at, and below them any of x19 - x28 the body
+// uses. Follows AAPCS64, so the caller pops any arguments it put on the stack
+void CodeGenerator::function(int id) {
+	IrNode& node = ir.node(id);
+	const FunctionScope& scope = ir.functionMap.scopes[node.a];
+	int frame = scope.frameSize();
+	int saved = allocator.loopRegisters(node.b, node.a);
+	saved += saved % 2; // saved in pairs
+
+	currentFunction = node.a;
+
+	placeLabel(label(ir.functionMap.getLabel(node.a)));
+
+	if (frame + 16 <= 512) { // fits the stp offset, so one instruction makes the whole frame
+		add(makeMemoryInstr(OP_STP, REG_FP, REG_SP, -(frame + 16), ADDRESS_PRE, REG_LR));
+	} else {
+		adjustStack(OP_SUB, frame);
+		add(makeMemoryInstr(OP_STP, REG_FP, REG_SP, -16, ADDRESS_PRE, REG_LR));
+	}
+	add(makeInstr(OP_MOV, REG_FP, REG_SP));
+
+	for (int i = 0; i < scope.registerParams(); i += 2) { // save the parameters, calls in the body reuse x0 - x7
+		int offset = scope.getParamOffset(i);
+
+		if (i + 1 < scope.registerParams()) add(makeMemoryInstr(OP_STP, i, REG_FP, offset, ADDRESS_OFFSET, i + 1));
+		else add(makeMemoryInstr(OP_STR, i, REG_FP, offset));
+	}
+
+	for (int i = 0; i < saved; i += 2) { // x19 - x28 belong to the caller
+		add(makeMemoryInstr(OP_STP, FIRST_SAVED_REGISTER + i, REG_SP, -16, ADDRESS_PRE, FIRST_SAVED_REGISTER + i + 1));
+	}
+
+	block(node.b);
+
+	for (int i = saved - 2; i >= 0; i -= 2) {
+		add(makeMemoryInstr(OP_LDP, FIRST_SAVED_REGISTER + i, REG_SP, 16, ADDRESS_POST, FIRST_SAVED_REGISTER + i + 1));
+	}
+
+	add(makeMemoryInstr(OP_LDP, REG_FP, REG_SP, 16, ADDRESS_POST, REG_LR));
+	adjustStack(OP_ADD, frame);
+	add(makeInstr(OP_RET));
+	add(makeInstr(OP_LTORG));
+
+	flush(functionCode);
+	currentFunction = -1;
+}
+
+// Puts value in the variable an ASSIGN or ASSIGN_LOCAL writes
+void CodeGenerator::assign(int id, int value) {
+	IrNode& node = ir.node(id);
+
+	if (node.op == IR_ASSIGN_LOCAL) {
+		int reg = loop.findLocal(node.a);
+		if (reg != -1) add(makeInstr(OP_MOV, reg, value));
+		else add(makeMemoryInstr(OP_STR, value, REG_FP, ir.functionMap.scopes[node.c].getLocalOffset(node.a)));
+		return;
+	}
+
+	int reg = loop.find(node.a);
+	if (reg != -1) {
+		add(makeInstr(OP_MOV, reg, value));
+		return;
+	}
+
+	int address = temps.take();
+	add(makeLabelInstr(OP_ADR, label(ir.symbolMap.getLabel(node.a)), address));
+	add(makeMemoryInstr(OP_STR, value, address, 0));
+	temps.release(address);
+}
+
+// Works out the expression, returns the register holding its value, which the caller releases
+int CodeGenerator::expression(int id) {
+	countNeeds(id);
+	return evaluate(id);
+}
+
+// 1 when the node is a variable kept in a loop register, which it can be read from in place
+int CodeGenerator::inRegister(int id) {
+	IrNode& node = ir.node(id);
+
+	if (node.op == IR_VAR) return loop.find(node.a) != -1;
+	if (node.op == IR_LOCAL) return loop.findLocal(node.a) != -1;
+	return 0;
+}
+
+// 1 for add or sub by a constant that fits the instruction
+int CodeGenerator::immediateOperand(int id) {
+	IrNode& node = ir.node(id);
+	if (node.op != IR_ADD && node.op != IR_SUB) return 0;
+	return ir.isInteger(node.b) && arithmeticImmediate(ir.node(node.b).value);
+}
+
+// Sethi-Ullman numbering: temporaries the expression needs, worked out
+// for every node under id so evaluate() can do the hungrier side first
+int CodeGenerator::countNeeds(int id) {
+	IrNode& node = ir.node(id);
+	int need;
+
+	switch (node.op) {
+		case IR_NUMBER:
+		case IR_PARAM:
+		case IR_VAR:
+		case IR_LOCAL:
+			need = inRegister(id) ? 0 : 1;
+			break;
+		case IR_NEG:
+		case IR_SHL:
+		case IR_AND:
+			need = max(countNeeds(node.a), 1);
+			break;
+		default: {
+			if (immediateOperand(id)) {
+				need = max(countNeeds(node.a), 1);
+				break;
+			}
+			if (constantDivisor(id)) { // the dividend, the magic number and for % the divisor
+				need = max(countNeeds(node.a), node.op == IR_MOD ? 3 : 2);
+				break;
+			}
+
+			int left = countNeeds(node.a);
+			int right = countNeeds(node.b);
+			need = (left == right) ? left + 1 : max(left, right);
+			need = max(need, 1);
+		}
+	}
+
+	needs[id] = need;
+	return need;
+}
+
+// Register for the result of an instruction reading a and b: one of them if
+// it's a temporary (releasing the other), otherwise a new one
+int CodeGenerator::destination(int a, int b) {
+	if (temps.owns(a)) {
+		if (b != a) temps.release(b);
+		return a;
+	}
+	if (temps.owns(b)) return b;
+	return temps.take();
+}
+
+// Evaluates both sides of a binary operation, the one needing more
+// registers first. When the second side needs more than are left, the
+// first value waits on the stack
+void CodeGenerator::operandPair(int left, int right, int& a, int& b) {
+	int first = (needs[right] > needs[left]) ? right : left;
+	int second = (first == left) ? right : left;
+
+	int firstValue = evaluate(first);
+	int spilled = temps.owns(firstValue) && temps.available() < needs[second];
+
+	if (spilled) {
+		add(makeMemoryInstr(OP_STR, firstValue, REG_SP, -16, ADDRESS_PRE));
+		temps.release(firstValue);
+	}
+
+	int secondValue = evaluate(second);
+
+	if (spilled) {
+		firstValue = temps.take();
+		add(makeMemoryInstr(OP_LDR, firstValue, REG_SP, 16, ADDRESS_POST));
+	}
+
+	a = (first == left) ? firstValue : secondValue;
+	b = (first == left) ? secondValue : firstValue;
+}
+
+// Emits the expression with countNeeds() already run over it, each
+// instruction writing straight into a register from the pool
+int CodeGenerator::evaluate(int id) {
+	IrNode& node = ir.node(id);
+
+	switch (node.op) {
+		case IR_NUMBER: {
+			int reg = temps.take();
+
+			if (!ir.isInteger(id)) {
+				Instr number = makeInstr(OP_MOVZ, reg);
+				number.label = label(ir.numberText[node.a]);
+				add(number);
+				return reg;
+			}
+
+			constant(reg, node.value);
+			return reg;
+		}
+		case IR_PARAM: {
+			int reg = temps.take();
+			add(makeMemoryInstr(OP_LDR, reg, REG_FP, ir.functionMap.scopes[node.b].getParamOffset(node.a)));
+			return reg;
+		}
+		case IR_LOCAL: {
+			if (loop.findLocal(node.a) != -1) return loop.findLocal(node.a);
+
+			int reg = temps.take();
+			add(makeMemoryInstr(OP_LDR, reg, REG_FP, ir.functionMap.scopes[node.b].getLocalOffset(node.a)));
+			return reg;
+		}
+		case IR_VAR: {
+			if (loop.find(node.a) != -1) return loop.find(node.a);
+
+			int reg = temps.take();
+			add(makeLabelInstr(OP_ADR, label(ir.symbolMap.getLabel(node.a)), reg));
+			add(makeMemoryInstr(OP_LDR, reg, reg, 0));
+			return reg;
+		}
+		case IR_NEG: {
+			int value = evaluate(node.a);
+			int reg = destination(value, value);
+			add(makeInstr(OP_NEG, reg, -1, value));
+			return reg;
+		}
+		case IR_SHL:
+		case IR_AND: {
+			int value = evaluate(node.a);
+			int reg = destination(value, value);
+			add(makeInstr(node.op == IR_SHL ? OP_LSL_IMM : OP_AND_IMM, reg, value, -1, node.value));
+			return reg;
+		}
+		case IR_ADD:
+		case IR_SUB:
+		case IR_MUL:
+		case IR_DIV:
+		case IR_MOD:
+			break;
+		default:
+			emitter.abort("Unexpected IR node in an expression");
+	}
+
+	if (immediateOperand(id)) { // add and sub take a 12 bit constant, negative ones flip the instruction
+		long long constant = ir.node(node.b).value;
+		int subtract = (node.op == IR_SUB) != (constant < 0);
+
+		int value = evaluate(node.a);
+		int reg = destination(value, value);
+		add(makeInstr(subtract ? OP_SUB_IMM : OP_ADD_IMM, reg, value, -1, constant < 0 ? -constant : constant));
+		return reg;
+	}
+
+	if (constantDivisor(id)) return divideByConstant(id);
+
+	int a, b;
+	operandPair(node.a, node.b, a, b);
+
+	if (node.op == IR_MOD) {
+		add(makeInstr(OP_UDIV, 8, a, b));	// a is the dividend, b the divisor and x8 the quotient
+		int reg = destination(a, b);
+		Instr remainder = makeInstr(OP_MSUB, reg, 8, b);	// remainder = dividend - quotient * divisor
+		remainder.ra = a;
+		add(remainder);
+		return reg;
+	}
+
+	OPCODE op = OP_ADD;
+	if (node.op == IR_SUB) op = OP_SUB;
+	else if (node.op == IR_MUL) op = OP_MUL;
+	else if (node.op == IR_DIV) op = OP_SDIV;
+
+	int reg = destination(a, b);
+	add(makeInstr(op, reg, a, b));
+	return reg;
+}
+
+// Puts an integer in reg
+void CodeGenerator::constant(int reg, long long value) {
+	vector<Instr> load;
+	immediateInstrs(reg, value, load);
+
+	if (load.size() > 2 && loopDepth > 0) { // in a loop one load beats three or four movs
+		add(makeInstr(OP_LDR_LITERAL, reg, -1, -1, value));
+		return;
+	}
+
+	for (Instr& instr : load) add(instr);
+}
+
+// 1 for / or % by a constant that divideByConstant() does without a divide
+int CodeGenerator::constantDivisor(int id) {
+	IrNode& node = ir.node(id);
+	if ((node.op != IR_DIV && node.op != IR_MOD) || !ir.isInteger(node.b)) return 0;
+
+	long long divisor = ir.node(node.b).value;
+	if (node.op == IR_DIV) return divisor != 0 && divisor != 1 && divisor != -1;
+
+	unsigned long long d = divisor;
+	return (d & (d - 1)) != 0; // the folder already made a power of two an and
+}
+
+// / (signed, rounding towards zero) and % (unsigned) by a constant, with
+// multiplies and shifts in place of sdiv or udiv and msub. x8 holds the
+// corrections along the way
+int CodeGenerator::divideByConstant(int id) {
+	IrNode& node = ir.node(id);
+	long long divisor = ir.node(node.b).value;
+	int value = evaluate(node.a);
+
+	if (node.op == IR_MOD) { // n - (n / d) * d
+		DivisionMagic magic = unsignedMagic(divisor);
+		int quotient = temps.take();
+
+		constant(quotient, magic.multiplier);
+		add(makeInstr(OP_UMULH, quotient, value, quotient));
+
+		if (magic.add) { // (((n - t) >> 1) + t), the 65th bit without overflowing
+			add(makeInstr(OP_SUB, 8, value, quotient));
+			add(makeInstr(OP_LSR_IMM, 8, 8, -1, 1));
+			add(makeInstr(OP_ADD, quotient, 8, quotient));
+		}
+		if (magic.shift > 0) add(makeInstr(OP_LSR_IMM, quotient, quotient, -1, magic.shift));
+
+		int d = temps.take();
+		constant(d, divisor);
+
+		Instr remainder = makeInstr(OP_MSUB, quotient, quotient, d);
+		remainder.ra = value;
+		add(remainder);
+
+		temps.release(d);
+		temps.release(value);
+		return quotient;
+	}
+
+	unsigned long long d = (divisor < 0) ? 0 - (unsigned long long) divisor : divisor;
+	int reg;
+
+	if ((d & (d - 1)) == 0) { // shift, with d - 1 added to negative dividends first so it rounds towards zero
+		int log = floorLog2(d);
+
+		add(makeInstr(OP_ASR_IMM, 8, value, -1, 63));
+		add(makeInstr(OP_LSR_IMM, 8, 8, -1, 64 - log));
+		reg = destination(value, value);
+		add(makeInstr(OP_ADD, reg, value, 8));
+		add(makeInstr(OP_ASR_IMM, reg, reg, -1, log));
+	} else {
+		DivisionMagic magic = signedMagic(d);
+		reg = temps.take();
+
+		constant(reg, magic.multiplier);
+		add(makeInstr(OP_SMULH, reg, value, reg));
+		if (magic.add) add(makeInstr(OP_ADD, reg, reg, value));
+		temps.release(value);
+
+		if (magic.shift > 0) add(makeInstr(OP_ASR_IMM, reg, reg, -1, magic.shift));
+		add(makeInstr(OP_LSR_IMM, 8, reg, -1, 63)); // + 1 when negative
+		add(makeInstr(OP_ADD, reg, reg, 8));
+	}
+
+	if (divisor < 0) add(makeInstr(OP_NEG, reg, -1, reg));
+	return reg;
+}
+
+// Sides of a condition, with a constant moved to the right where cmp can take it
+void CodeGenerator::operands(int id, int& left, int& right, IR_OP& op) {
+	IrNode& node = ir.node(id);
+	left = node.a;
+	right = node.b;
+	op = node.op;
+
+	if (ir.isInteger(left) && !ir.isInteger(right)) {
+		swap(left, right);
+		if (op == IR_GT) op = IR_LT;
+		else if (op == IR_LT) op = IR_GT;
+		else if (op == IR_GE) op = IR_LE;
+		else if (op == IR_LE) op = IR_GE;
+	}
+}
+
+// Sets the flags for the condition, returns the flag condition that holds when it's true
+CONDITION CodeGenerator::compare(int id) {
+	int left, right;
+	IR_OP op;
+	operands(id, left, right, op);
+
+	if (ir.isInteger(right) && arithmeticImmediate(ir.node(right).value)) {
+		int value = expression(left);
+		add(makeInstr(OP_CMP_IMM, -1, value, -1, ir.node(right).value));
+		temps.release(value);
+	} else {
+		countNeeds(left);
+		countNeeds(right);
+
+		int a, b;
+		operandPair(left, right, a, b);
+		add(makeInstr(OP_CMP, -1, a, b));
+		temps.release(a);
+		temps.release(b);
+	}
+
+	switch (op) {
+		case IR_EQ: return COND_EQ;
+		case IR_NE: return COND_NE;
+		case IR_GT: return COND_GT;
+		case IR_GE: return COND_GE;
+		case IR_LT: return COND_LT;
+		case IR_LE: return COND_LE;
+		default:
+			emitter.abort("Unexpected IR node in a condition");
+	}
+	return COND_AL;
+}
+
+// Branches to exitLabel when the condition is false. Comparisons with zero
+// don't need the flags: == and != are a cbz or cbnz, < and >= test the sign
+// bit and x % 2 tests bit 0, with tbz or tbnz
+void CodeGenerator::condition(int id, int exitLabel) {
+	int left, right;
+	IR_OP op;
+	operands(id, left, right, op);
+
+	if (ir.isInteger(right) && ir.node(right).value == 0) {
+		IrNode& tested = ir.node(left);
+
+		if ((op == IR_EQ || op == IR_NE) && tested.op == IR_AND && (tested.value & (tested.value - 1)) == 0) { // a single bit
+			Instr branch = makeLabelInstr(op == IR_EQ ? OP_TBNZ : OP_TBZ, exitLabel);
+			branch.rn = expression(tested.a);
+			branch.imm = __builtin_ctzll(tested.value);
+			add(branch);
+			temps.release(branch.rn);
+			return;
+		}
+
+		if (op == IR_EQ || op == IR_NE) {
+			Instr branch = makeLabelInstr(op == IR_EQ ? OP_CBNZ : OP_CBZ, exitLabel);
+			branch.rn = expression(left);
+			add(branch);
+			temps.release(branch.rn);
+			return;
+		}
+
+		if (op == IR_LT || op == IR_GE) {
+			Instr branch = makeLabelInstr(op == IR_LT ? OP_TBZ : OP_TBNZ, exitLabel);
+			branch.rn = expression(left);
+			branch.imm = 63;
+			add(branch);
+			temps.release(branch.rn);
+			return;
+		}
+	}
+
+	Instr branch = makeLabelInstr(OP_BCOND, exitLabel);
+	branch.cond = invertCondition(compare(id));
+	add(branch);
+}
+
+// 1 for an expression short enough to work out even when its value isn't used
+int CodeGenerator::cheap(int id, int& budget) {
+	IrNode& node = ir.node(id);
+	if (--budget < 0 || node.op == IR_DIV || node.op == IR_MOD) return 0;
+
+	switch (node.op) {
+		case IR_NUMBER:
+		case IR_VAR:
+		case IR_PARAM:
+		case IR_LOCAL:
+			return 1;
+		default:
+			if (!cheap(node.a, budget)) return 0;
+			return node.b == -1 || cheap(node.b, budget);
+	}
+}
+
+// 1 when both are the same variable, parameter or integer
+int CodeGenerator::sameValue(int a, int b) {
+	IrNode& first = ir.node(a);
+	IrNode& second = ir.node(b);
+
+	if (ir.isInteger(a) && ir.isInteger(b)) return first.value == second.value;
+	if (first.op != second.op || first.a != second.a || first.b != second.b) return 0;
+	return first.op == IR_VAR || first.op == IR_PARAM || first.op == IR_LOCAL;
+}
+
+// 1 for an expression that's something + 1
+int CodeGenerator::increments(int id) {
+	IrNode& node = ir.node(id);
+	return node.op == IR_ADD && ir.isInteger(node.b) && ir.node(node.b).value == 1;
+}
+
+// IF with a single assignment on each side to the same variable, or only on
+// the THEN side when the variable is in a register, and cheap values: both
+// values are worked out and csel picks one, so there's nothing to mispredict.
+// v = x + 1 on one side and v = x on the other is a single csinc
+int CodeGenerator::select(int id) {
+	IrNode& node = ir.node(id);
+	int thenAssign = node.b;
+	int elseAssign = node.c;
+
+	if (thenAssign == -1 || ir.node(thenAssign).next != -1) return 0;
+	if (elseAssign != -1 && ir.node(elseAssign).next != -1) return 0;
+
+	IrNode& target = ir.node(thenAssign);
+	if (target.op != IR_ASSIGN && target.op != IR_ASSIGN_LOCAL) return 0;
+
+	int reg = (target.op == IR_ASSIGN) ? loop.find(target.a) : loop.findLocal(target.a);
+	int thenValue = target.b;
+	int elseValue = -1; // the variable keeps its value
+
+	if (elseAssign != -1) {
+		IrNode& other = ir.node(elseAssign);
+		if (other.op != target.op || other.a != target.a) return 0;
+		elseValue = other.b;
+	} else if (reg == -1) { // would be a load and store every time just to write the same value back
+		return 0;
+	}
+
+	int budget = SELECT_LIMIT;
+	if (!cheap(thenValue, budget) || (elseValue != -1 && !cheap(elseValue, budget))) return 0;
+
+	CONDITION cond = compare(node.a);
+	int base = -1; // the value csinc adds 1 to
+
+	if (increments(thenValue)) {
+		int plain = ir.node(thenValue).a;
+		if (elseValue == -1 ? (ir.node(plain).op == (target.op == IR_ASSIGN ? IR_VAR : IR_LOCAL) && ir.node(plain).a == target.a) : sameValue(plain, elseValue)) {
+			base = plain;
+			cond = invertCondition(cond); // csinc adds 1 when its condition fails
+		}
+	} else if (elseValue != -1 && increments(elseValue) && sameValue(ir.node(elseValue).a, thenValue)) {
+		base = thenValue;
+	}
+
+	Instr choice;
+
+	if (base != -1) {
+		int value = expression(base);
+		choice = makeInstr(OP_CSINC, destination(value, value), value, value);
+	} else {
+		int a = expression(thenValue);
+		int b = (elseValue != -1) ? expression(elseValue) : reg;
+		choice = makeInstr(OP_CSEL, destination(a, b), a, b);
+	}
+
+	choice.cond = cond;
+	add(choice);
+	assign(thenAssign, choice.rd);
+	temps.release(choice.rd);
+	return 1;
+}
+
+#endif
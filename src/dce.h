@@ -0,0 +1,291 @@
+#include <vector>
+#include <string>
+
+#include "ir.h"
+#include "trace.h"
+
+#ifndef DCE_H
+#define DCE_H
+using namespace std;
+
+// Dead code eliminator :
+/*
+	Takes out of the IR whatever can't make a difference to what the program
+	does: FUNCs no DO reaches from the top level, assignments to variables
+	nothing reads (expressions can't have side effects, calls are statements),
+	LABELs no GOTO jumps to, statements after a GOTO up to the next LABEL that
+	is jumped to, and the side of an IF or WHILE whose condition compares two
+	constants and can never be taken. Taking something out can leave more
+	behind it unused, so it runs until nothing changes. Globals and string
+	literals the remaining code doesn't use are left out of .data by the code
+	generator, which only writes out the labels it referenced. Literal PRINTs
+	left next to each other are joined into one, which is written out in one
+	go.
+*/
+class DeadCodeEliminator {
+	public:
+		DeadCodeEliminator(IrProgram& inputIr);
+		void program();
+		void mark(int id);
+		void markExpression(int id);
+		void markFunction(int function);
+		int sweep(int id);
+		int containsTarget(int id);
+		int constantCondition(int id);
+		void joinPrints(string& text, int id);
+		void endPrints(int into, const string& text);
+
+		IrProgram& ir;
+		vector<int> bodies;		// FUNC node of each function
+		vector<char> called;		// functions reachable from the top level
+		vector<char> read;		// globals some reachable code reads
+		vector<vector<char>> readLocals;	// locals of each function its code reads
+		vector<char> targets;		// labels some reachable GOTO jumps to
+		int changed;
+		int removed;	// statements taken out
+		int joined;	// PRINTs joined onto the one before
+};
+
+DeadCodeEliminator::DeadCodeEliminator(IrProgram& inputIr) : ir(inputIr) {
+	changed = 0;
+	removed = 0;
+	joined = 0;
+}
+
+void DeadCodeEliminator::program() {
+	bodies.assign(ir.functionMap.scopes.size(), -1);
+	for (int id = ir.main; id != -1; id = ir.node(id).next) { // functions are only defined at the top level
+		if (ir.node(id).op == IR_FUNC) bodies[ir.node(id).a] = id;
+	}
+
+	do {
+		called.assign(ir.functionMap.scopes.size(), 0);
+		read.assign(ir.symbolMap.size(), 0);
+		readLocals.assign(ir.functionMap.scopes.size(), {});
+		targets.assign(ir.labels.size(), 0);
+
+		mark(ir.main);
+
+		changed = 0;
+		ir.main = sweep(ir.main);
+	} while (changed);
+
+	TRACE(TRACE_STATUS, "dead code: " << removed << " statements removed, " << joined << " PRINTs joined" << endl);
+}
+
+// Records what the statements chained from id call, read and jump to
+void DeadCodeEliminator::mark(int id) {
+	for (; id != -1; id = ir.node(id).next) {
+		IrNode& node = ir.node(id);
+
+		switch (node.op) {
+			case IR_IF:
+				markExpression(node.a);
+				mark(node.b);
+				mark(node.c);
+				break;
+			case IR_WHILE:
+				markExpression(node.a);
+				mark(node.b);
+				break;
+			case IR_GOTO:
+				targets[node.a] = 1;
+				break;
+			case IR_ASSIGN:
+			case IR_ASSIGN_LOCAL:
+				markExpression(node.b);
+				break;
+			case IR_PRINT_VALUE:
+				markExpression(node.a);
+				break;
+			case IR_CALL:
+				for (int arg = node.b; arg != -1; arg = ir.node(arg).next) markExpression(arg);
+				markFunction(node.a);
+				break;
+			default: // a FUNC only runs when it's called
+				break;
+		}
+	}
+}
+
+void DeadCodeEliminator::markFunction(int function) {
+	if (called[function]) return; // recursion
+	called[function] = 1;
+	readLocals[function].assign(ir.functionMap.scopes[function].locals.size(), 0);
+
+	if (bodies[function] != -1) mark(ir.node(bodies[function]).b);
+}
+
+void DeadCodeEliminator::markExpression(int id) {
+	IrNode& node = ir.node(id);
+
+	switch (node.op) {
+		case IR_NUMBER:
+		case IR_PARAM:
+			return;
+		case IR_VAR:
+			read[node.a] = 1;
+			return;
+		case IR_LOCAL:
+			readLocals[node.b][node.a] = 1;
+			return;
+		default:
+			markExpression(node.a);
+			if (node.b != -1) markExpression(node.b);
+	}
+}
+
+// 1 when a GOTO can land inside the statement, so it has to stay even when nothing runs into it
+int DeadCodeEliminator::containsTarget(int id) {
+	IrNode& node = ir.node(id);
+
+	switch (node.op) {
+		case IR_LABEL:
+			return targets[node.a];
+		case IR_IF:
+			for (int inner = node.c; inner != -1; inner = ir.node(inner).next) {
+				if (containsTarget(inner)) return 1;
+			}
+			[[fallthrough]];
+		case IR_WHILE:
+			for (int inner = node.b; inner != -1; inner = ir.node(inner).next) {
+				if (containsTarget(inner)) return 1;
+			}
+			return 0;
+		default:
+			return 0;
+	}
+}
+
+// 1 or 0 when the condition compares two integer constants, -1 when it has to be tested
+int DeadCodeEliminator::constantCondition(int id) {
+	IrNode& node = ir.node(id);
+	if (!ir.isInteger(node.a) || !ir.isInteger(node.b)) return -1;
+
+	long long x = ir.node(node.a).value;
+	long long y = ir.node(node.b).value;
+
+	switch (node.op) {
+		case IR_EQ: return x == y;
+		case IR_NE: return x != y;
+		case IR_GT: return x > y;
+		case IR_GE: return x >= y;
+		case IR_LT: return x < y;
+		case IR_LE: return x <= y;
+		default: return -1;
+	}
+}
+
+// Adds id's text to the text of the run of PRINTs it's joined onto
+void DeadCodeEliminator::joinPrints(string& text, int id) {
+	// every PRINT writes the 0 ending its string too. All three octal digits, so a digit after it isn't read as part of it
+	text += "\\000" + ir.stringLiterals.names[ir.node(id).a];
+	joined++;
+}
+
+// Makes the first PRINT of a run print the whole run's text. Only done once the run ends, so a long run isn't copied for every PRINT in it
+void DeadCodeEliminator::endPrints(int into, const string& text) {
+	if (into != -1) ir.node(into).a = ir.stringLiterals.insert(text);
+}
+
+// Rebuilds the chain from id without its dead statements, returns its new first statement
+int DeadCodeEliminator::sweep(int id) {
+	int first = -1;
+	int last = -1;
+	int unreachable = 0; // after a GOTO, until something jumps back in
+	int printRun = -1; // the PRINT the ones after it are being joined onto
+	string runText;
+
+	for (int next; id != -1; id = next) {
+		IrNode& node = ir.node(id);
+		next = node.next;
+		node.next = -1;
+
+		if (unreachable && node.op != IR_FUNC) { // definitions aren't run where they're written
+			if (!containsTarget(id)) {
+				changed = 1;
+				removed++;
+				continue;
+			}
+			unreachable = 0;
+		}
+
+		int keep = 1;
+
+		switch (node.op) {
+			case IR_LABEL:
+				keep = targets[node.a];
+				break;
+			case IR_ASSIGN:
+				keep = read[node.a];
+				break;
+			case IR_ASSIGN_LOCAL:
+				keep = readLocals[node.c][node.a];
+				break;
+			case IR_FUNC:
+				keep = called[node.a];
+				if (keep) ir.node(id).b = sweep(node.b);
+				break;
+			case IR_GOTO:
+				unreachable = 1;
+				break;
+			case IR_WHILE:
+				if (constantCondition(node.a) == 0 && !containsTarget(id)) keep = 0;
+				else ir.node(id).b = sweep(node.b);
+				break;
+			case IR_IF: {
+				int taken = constantCondition(node.a);
+				int skipped = (taken == 1) ? node.c : node.b;
+
+				int reachable = 1; // a GOTO into the side that's never taken keeps the IF
+				for (int inner = skipped; inner != -1 && reachable; inner = ir.node(inner).next) {
+					if (containsTarget(inner)) reachable = 0;
+				}
+
+				if (taken == -1 || !reachable) {
+					int thenBlock = sweep(node.b);
+					int elseBlock = sweep(ir.node(id).c);
+					ir.node(id).b = thenBlock;
+					ir.node(id).c = elseBlock;
+					break;
+				}
+
+				int kept = sweep(taken ? node.b : node.c); // the side that always runs takes the IF's place
+				changed = 1;
+				removed++;
+
+				for (int inner = kept; inner != -1;) {
+					int after = ir.node(inner).next;
+					ir.append(first, last, inner);
+					inner = after;
+				}
+				continue;
+			}
+			default:
+				break;
+		}
+
+		if (!keep) {
+			changed = 1;
+			removed++;
+			continue;
+		}
+
+		if (node.op == IR_PRINT && last != -1 && ir.node(last).op == IR_PRINT) {
+			if (printRun != last) {
+				endPrints(printRun, runText);
+				printRun = last;
+				runText = ir.stringLiterals.names[ir.node(last).a];
+			}
+			joinPrints(runText, id);
+			continue;
+		}
+
+		ir.append(first, last, id);
+	}
+
+	endPrints(printRun, runText);
+	return first;
+}
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef DIVIDE_H
+#define DIVIDE_H
+using namespace std;
+
+// Division by constants :
+/*
+	sdiv and udiv take several times as long as a multiply, so dividing by a
+	constant d multiplies by a "magic" fixed point approximation of 2^64 / d
+	instead, keeps the high half of the 128 bit product (smulh or umulh) and
+	shifts it down. Some divisors need a 65 bit multiplier, for those the
+	top bit is put back by adding the dividend after the multiply. The
+	numbers are worked out the way libdivide does, and only for divisors
+	that aren't a power of two, which are a shift.
+*/
+struct DivisionMagic {
+	unsigned long long multiplier;
+	int shift;
+	int add;	// the multiplier has a 65th bit, the dividend is added back in after the multiply
+};
+
+// floor(log2(d)) for d > 0
+int floorLog2(unsigned long long d) {
+	return 63 - __builtin_clzll(d);
+}
+
+// Magic for unsigned division by d, which isn't 0 or a power of two:
+// q = umulh(n, multiplier) >> shift, or with add set
+// q = (((n - t) >> 1) + t) >> shift where t = umulh(n, multiplier)
+DivisionMagic unsignedMagic(unsigned long long d) {
+	int log = floorLog2(d);
+	unsigned __int128 dividend = (unsigned __int128) 1 << (64 + log);
+	unsigned long long multiplier = (unsigned long long) (dividend / d);
+	unsigned long long remainder = (unsigned long long) (dividend % d);
+
+	DivisionMagic magic = {0, log, 0};
+
+	if (d - remainder >= (1ULL << log)) { // the 64 bit multiplier isn't exact enough, use 65 bits
+		unsigned long long twice = remainder + remainder;
+		multiplier += multiplier;
+		if (twice >= d || twice < remainder) multiplier++;
+		magic.add = 1;
+	}
+
+	magic.multiplier = multiplier + 1;
+	return magic;
+}
+
+// Magic for signed division by d > 2, which isn't a power of two:
+// q = smulh(n, multiplier), plus n with add set, then q >> shift
+// (arithmetic), and 1 added when that's negative to round towards zero
+DivisionMagic signedMagic(unsigned long long d) {
+	int log = floorLog2(d);
+	unsigned __int128 dividend = (unsigned __int128) 1 << (63 + log);
+	unsigned long long multiplier = (unsigned long long) (dividend / d);
+	unsigned long long remainder = (unsigned long long) (dividend % d);
+
+	DivisionMagic magic = {0, log - 1, 0};
+
+	if (d - remainder >= (1ULL << log)) {
+		unsigned long long twice = remainder + remainder;
+		multiplier += multiplier;
+		if (twice >= d || twice < remainder) multiplier++;
+		magic.shift = log;
+		magic.add = 1;
+	}
+
+	magic.multiplier = multiplier + 1;
+	return magic;
+}
+
+#endif
@@ -1,7 +1,14 @@
 #include <iostream>
 #include <string>
-#include <fstream>
+#include <string_view>
+#include <vector>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
 
+#include "outbuf.h"
+#include "instr.h"
+#include "object.h"
 
 #ifndef EMITTER_H
 #define EMITTER_H
@@ -11,37 +18,63 @@ class Emitter {
 	public:
 		Emitter(string filePath);
 		Emitter();
-		void emit(string codeIn);
-		void emitLine(string codeIn);
-		void headerLine(string codeIn);
-		void dataLine(string codeIn);
-		void functionLine(string codeIn);
+		void emit(string_view codeIn);
+		void emitLine(string_view codeIn);
+		void headerLine(string_view codeIn);
+		void dataLine(string_view codeIn);
+		void functionLine(string_view codeIn);
+		void bssLine(string_view codeIn);
 		void writeFile();
 		void abort(string message);
+		// Streaming mode
+		void startStreaming();
+		void spill(OutputBuffer& section, int fd);
+		void copyFile(int from, int to);
+		int openTemp();
+		// Object file mode
+		void objectMode();
+		void executableMode();
+		void entry(string_view name);
+		void quad(string_view label);
+		void ascii(string_view label, string_view text, int terminated);
+		void length(string_view label);
+		void reserve(string_view label, size_t bytes, size_t alignment = 1);
+		void instructions(const vector<Instr>& instrs, TEXT_PART part);
 
 		string path;
-		string header;
-		string code;
-		string functions;
-		string data;
+		OutputBuffer header;
+		OutputBuffer code;
+		OutputBuffer functions;
+		OutputBuffer data;
+		OutputBuffer bss;	// only ever a few lines, never spilled
+
+		static const size_t STREAM_LIMIT = 1024 * 1024; // bytes a section holds before it's spilled
+		int streaming;
+		int headerWritten;
+		int outFd;
+		int functionsFd;
+		int dataFd;
+		int binary;	// writing an ELF object instead of assembly, set by objectMode()
+		int executable;	// linking that object into a static executable, set by executableMode()
+		ObjectFile object;
 };
 
 Emitter::Emitter(string filePath) {
 	path = filePath;
-
-	header = "";
-	code = "";
-	functions = "";
-	data = "";
+	streaming = 0;
+	headerWritten = 0;
+	outFd = functionsFd = dataFd = -1;
+	binary = 0;
+	executable = 0;
 }
 
 Emitter::Emitter() {
 	path = "out.s";
-
-	header = "";
-	code = "";
-	functions = "";
-	data = "";
+	streaming = 0;
+	headerWritten = 0;
+	outFd = functionsFd = dataFd = -1;
+	binary = 0;
+	executable = 0;
 }
 
 void Emitter::abort(string message) {
@@ -50,35 +83,235 @@ void Emitter::abort(string message) {
 	exit(1);
 }
 
-void Emitter::emit(string codeIn) {
-	code += codeIn;
+void Emitter::emit(string_view codeIn) {
+	code.append(codeIn);
+}
+
+void Emitter::emitLine (string_view codeIn) { 
+	code.append(codeIn);
+	code.append('\n');
+
+	if (streaming && code.size() >= STREAM_LIMIT) {
+		spill(header, outFd); // only holds anything before the first spill
+		spill(code, outFd);
+		headerWritten = 1;
+	}
+}
+
+void Emitter::headerLine(string_view codeIn) {
+	if (headerWritten) {
+		abort("Header line after the code was already written: " + string(codeIn));
+	}
+
+	header.append(codeIn);
+	header.append('\n');
+}
+
+void Emitter::dataLine(string_view codeIn) {
+	data.append(codeIn);
+	data.append('\n');
+
+	if (streaming && data.size() >= STREAM_LIMIT) spill(data, dataFd);
+}
+
+void Emitter::functionLine(string_view codeIn) {
+	functions.append(codeIn);
+	functions.append('\n');
+
+	if (streaming && functions.size() >= STREAM_LIMIT) spill(functions, functionsFd);
+}
+
+void Emitter::bssLine(string_view codeIn) {
+	bss.append(codeIn);
+	bss.append('\n');
+}
+
+// Streaming mode :
+/*
+	header and code are written to the output file as they fill up, so they
+	never hold more than STREAM_LIMIT. functions and data come after the code in
+	the file, so they're spilled to unlinked temporary files instead and copied
+	over by writeFile. Only these output buffers are bounded: the parser still
+	keeps the whole IrProgram, so the compiler's memory grows with the program.
+*/
+void Emitter::startStreaming() {
+	outFd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (outFd < 0) {
+		abort("Cannot open file " + path);
+	}
+
+	functionsFd = openTemp();
+	dataFd = openTemp();
+	streaming = 1;
 }
 
-void Emitter::emitLine (string codeIn) { 
-	code += codeIn + "\n";
+// Temporary file that's already unlinked, so it goes away with the descriptor
+int Emitter::openTemp() {
+	FILE* temp = tmpfile();
+	if (temp == nullptr) {
+		abort("Cannot create a temporary file");
+	}
+
+	int fd = dup(fileno(temp));
+	fclose(temp);
+	return fd;
 }
 
-void Emitter::headerLine(string codeIn) {
-	header += codeIn + "\n";
+// Writes out everything the section holds and empties it
+void Emitter::spill(OutputBuffer& section, int fd) {
+	vector<iovec> iov;
+	section.gather(iov);
+
+	if (!writeAll(fd, iov)) {
+		abort("Cannot write file " + path);
+	}
+	section.clear();
 }
 
-void Emitter::dataLine(string codeIn) {
-	data += codeIn + "\n";
+// Appends the whole of a spilled temporary file to another file
+void Emitter::copyFile(int from, int to) {
+	static char buffer[64 * 1024];
+
+	lseek(from, 0, SEEK_SET);
+	ssize_t count;
+	while ((count = read(from, buffer, sizeof(buffer))) != 0) {
+		if (count < 0) {
+			if (errno == EINTR) continue;
+			abort("Cannot read temporary file");
+		}
+
+		vector<iovec> iov = {{buffer, (size_t) count}};
+		if (!writeAll(to, iov)) {
+			abort("Cannot write file " + path);
+		}
+	}
 }
 
-void Emitter::functionLine(string codeIn) {
-	functions += codeIn + "\n";
+// Object file mode :
+/*
+	With -c the emitter builds an object file instead of text. The code
+	generator hands it whole instruction lists rather than lines, and the
+	data goes through quad, ascii, length and reserve, which write the same
+	directives as lines in text mode. The object shares the code generator's
+	label table, so labels keep their ids.
+*/
+void Emitter::objectMode() {
+	binary = 1;
 }
 
+// The object linked on its own into a static executable, which is all a program needs since it makes its own system calls
+void Emitter::executableMode() {
+	binary = 1;
+	executable = 1;
+}
+
+// The global entry point, at the start of the code
+void Emitter::entry(string_view name) {
+	if (binary) {
+		int label = object.labels->insert(name);
+		object.global(label);
+		object.define(label, SECTION_TEXT, object.text[PART_CODE].size());
+		return;
+	}
+
+	headerLine(".global " + string(name));
+	headerLine(".text");
+	headerLine("\n" + string(name) + ":");
+}
+
+void Emitter::quad(string_view label) {
+	if (binary) object.quad(object.labels->insert(label));
+	else dataLine(string(label) + ": .quad 0");
+}
+
+// A string literal, with a 0 byte after it when terminated
+void Emitter::ascii(string_view label, string_view text, int terminated) {
+	if (binary) object.ascii(object.labels->insert(label), text, terminated);
+	else dataLine(string(label) + (terminated ? ": .asciz \"" : ": .ascii \"") + string(text) + "\"");
+}
+
+// label_len, the bytes from label to here
+void Emitter::length(string_view label) {
+	if (binary) object.length(object.labels->insert(string(label) + "_len"), object.labels->insert(label));
+	else dataLine(string(label) + "_len = . - " + string(label));
+}
+
+// Zeroed bytes in .bss
+void Emitter::reserve(string_view label, size_t bytes, size_t alignment) {
+	if (binary) {
+		object.reserve(object.labels->insert(label), bytes, alignment);
+		return;
+	}
+
+	if (alignment > 1) bssLine(".balign " + to_string(alignment));
+	bssLine(string(label) + ": .skip " + to_string(bytes));
+}
+
+void Emitter::instructions(const vector<Instr>& instrs, TEXT_PART part) {
+	object.instructions(instrs, part);
+}
+
+// Writes every section straight from its chunks with writev, without joining them first
 void Emitter::writeFile() {
-	ofstream outputFile(path);
+	static const char dataHeader[] = "\n\t.data\n";
+	static const char bssHeader[] = "\n\t.bss\n";
+
+	if (binary) {
+		object.write(path, executable);
+		return;
+	}
+
+	if (streaming) {
+		spill(header, outFd);
+		spill(code, outFd);
+
+		spill(functions, functionsFd);
+		copyFile(functionsFd, outFd);
+
+		vector<iovec> iov = {{(void*) dataHeader, sizeof(dataHeader) - 1}};
+		if (!writeAll(outFd, iov)) {
+			abort("Cannot write file " + path);
+		}
+
+		spill(data, dataFd);
+		copyFile(dataFd, outFd);
+
+		if (bss.size() > 0) {
+			iov = {{(void*) bssHeader, sizeof(bssHeader) - 1}};
+			if (!writeAll(outFd, iov)) {
+				abort("Cannot write file " + path);
+			}
+			spill(bss, outFd);
+		}
 
-	if (!outputFile.is_open()) {
+		close(functionsFd);
+		close(dataFd);
+		close(outFd);
+		return;
+	}
+
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+	if (fd < 0) {
 		abort("Cannot open file " + path);
 	}
 
-	outputFile << header + code + functions + "\n\t.data\n" + data;
-	outputFile.close();
+	vector<iovec> iov;
+	header.gather(iov);
+	code.gather(iov);
+	functions.gather(iov);
+	iov.push_back({(void*) dataHeader, sizeof(dataHeader) - 1});
+	data.gather(iov);
+	if (bss.size() > 0) {
+		iov.push_back({(void*) bssHeader, sizeof(bssHeader) - 1});
+		bss.gather(iov);
+	}
+
+	if (!writeAll(fd, iov)) {
+		abort("Cannot write file " + path);
+	}
+
+	close(fd);
 }
 
 #endif
@@ -0,0 +1,189 @@
+#include "instr.h"
+#include "immediate.h"
+
+#ifndef ENCODER_H
+#define ENCODER_H
+using namespace std;
+
+// Encoder :
+/*
+	Turns an Instr into its 32 bit AArch64 machine code, for writing object
+	files without going through an assembler. Instructions that refer to a
+	label are encoded with a displacement of 0, which setDisplacement fills
+	in once the label's address is known. Register 31 is sp or xzr depending
+	on the instruction, so where an instruction takes sp (mov, add and sub
+	with sp) the form that reads it as sp is picked.
+*/
+
+// Field for a register, both REG_SP and REG_XZR are 31
+unsigned registerField(int reg) {
+	return (reg == REG_XZR) ? 31 : (unsigned) reg;
+}
+
+// rd in bits 0 - 4, rn in 5 - 9, rm in 16 - 20
+unsigned registerFields(const Instr& instr) {
+	unsigned word = 0;
+	if (instr.rd != -1) word |= registerField(instr.rd);
+	if (instr.rn != -1) word |= registerField(instr.rn) << 5;
+	if (instr.rm != -1) word |= registerField(instr.rm) << 16;
+	return word;
+}
+
+// 12 bit immediate of add, sub and cmp, shifted left by 12 when it has to be. 0 if it doesn't fit
+int arithmeticField(long long value, unsigned& field) {
+	if (value >= 0 && value < 4096) {
+		field = (unsigned) value << 10;
+		return 1;
+	}
+	if (value >= 0 && (value & 0xfff) == 0 && value < (4096LL << 12)) {
+		field = (1u << 22) | (unsigned) (value >> 12) << 10;
+		return 1;
+	}
+	return 0;
+}
+
+// Loads and stores of size bytes: the scaled unsigned offset, unscaled, pre and post indexed forms
+int memoryWord(const Instr& instr, unsigned scaled, unsigned unscaled, int size, unsigned& word) {
+	long long offset = instr.imm;
+	unsigned registers = registerField(instr.rd) | registerField(instr.rn) << 5;
+
+	if (instr.mode == ADDRESS_OFFSET && offset >= 0 && offset % size == 0 && offset / size < 4096) {
+		word = scaled | (unsigned) (offset / size) << 10 | registers;
+		return 1;
+	}
+
+	if (offset < -256 || offset > 255) return 0;
+
+	unsigned index = (instr.mode == ADDRESS_PRE) ? 0xc00 : (instr.mode == ADDRESS_POST) ? 0x400 : 0;
+	word = unscaled | index | ((unsigned) offset & 0x1ff) << 12 | registers;
+	return 1;
+}
+
+// ldp and stp of two x registers
+int pairWord(const Instr& instr, unsigned offsetForm, unsigned& word) {
+	long long offset = instr.imm;
+	if (offset % 8 != 0 || offset < -512 || offset > 504) return 0;
+
+	unsigned form = offsetForm;
+	if (instr.mode == ADDRESS_PRE) form |= 0x00800000;
+	else if (instr.mode == ADDRESS_POST) form = (offsetForm & ~0x01000000u) | 0x00800000;
+
+	word = form | ((unsigned) (offset / 8) & 0x7f) << 15 | registerField(instr.rm) << 10 | registerField(instr.rn) << 5 | registerField(instr.rd);
+	return 1;
+}
+
+// Sets word to the machine code for instr, 0 when it can't be encoded
+int encodeInstr(const Instr& instr, unsigned& word) {
+	unsigned field;
+
+	switch (instr.op) {
+		case OP_MOV:
+			if (instr.rd == REG_SP || instr.rn == REG_SP) word = 0x91000000 | registerFields(instr); // add rd, rn, #0
+			else word = 0xaa0003e0 | registerField(instr.rn) << 16 | registerField(instr.rd); // orr rd, xzr, rn
+			return 1;
+		case OP_MOVZ:
+		case OP_MOVN:
+		case OP_MOVK: {
+			if (instr.label != -1) return 0; // a number kept as written, which isn't a whole number
+			unsigned base = (instr.op == OP_MOVZ) ? 0xd2800000 : (instr.op == OP_MOVN) ? 0x92800000 : 0xf2800000;
+			word = base | (unsigned) (instr.mode / 16) << 21 | ((unsigned) instr.imm & 0xffff) << 5 | registerField(instr.rd);
+			return 1;
+		}
+		case OP_ORR_IMM:
+		case OP_AND_IMM: {
+			unsigned encoding;
+			if (!logicalImmediate(instr.imm, encoding)) return 0;
+			word = (instr.op == OP_ORR_IMM ? 0xb2000000 : 0x92000000) | encoding << 10 | registerFields(instr);
+			return 1;
+		}
+		case OP_ADD:
+		case OP_SUB:
+			if (instr.rd == REG_SP || instr.rn == REG_SP) word = (instr.op == OP_ADD ? 0x8b206000 : 0xcb206000) | registerFields(instr); // extended register, uxtx
+			else word = (instr.op == OP_ADD ? 0x8b000000 : 0xcb000000) | registerFields(instr);
+			return 1;
+		case OP_ADD_IMM:
+		case OP_SUB_IMM: {
+			int add = (instr.op == OP_ADD_IMM) == (instr.imm >= 0); // a negative immediate is the other instruction
+			if (!arithmeticField(instr.imm < 0 ? -instr.imm : instr.imm, field)) return 0;
+			word = (add ? 0x91000000 : 0xd1000000) | field | registerFields(instr);
+			return 1;
+		}
+		case OP_MUL: word = 0x9b007c00 | registerFields(instr); return 1; // madd rd, rn, rm, xzr
+		case OP_SMULH: word = 0x9b407c00 | registerFields(instr); return 1;
+		case OP_UMULH: word = 0x9bc07c00 | registerFields(instr); return 1;
+		case OP_SDIV: word = 0x9ac00c00 | registerFields(instr); return 1;
+		case OP_UDIV: word = 0x9ac00800 | registerFields(instr); return 1;
+		case OP_MSUB: word = 0x9b008000 | registerField(instr.ra) << 10 | registerFields(instr); return 1;
+		case OP_CSEL: word = 0x9a800000 | (unsigned) instr.cond << 12 | registerFields(instr); return 1;
+		case OP_CSINC: word = 0x9a800400 | (unsigned) instr.cond << 12 | registerFields(instr); return 1;
+		case OP_NEG: word = 0xcb0003e0 | registerField(instr.rm) << 16 | registerField(instr.rd); return 1; // sub rd, xzr, rm
+		case OP_LSL_IMM: { // ubfm rd, rn, #(-shift mod 64), #(63 - shift)
+			unsigned shift = instr.imm & 63;
+			word = 0xd3400000 | ((64 - shift) & 63) << 16 | (63 - shift) << 10 | registerFields(instr);
+			return 1;
+		}
+		case OP_LSR_IMM: word = 0xd340fc00 | (unsigned) (instr.imm & 63) << 16 | registerFields(instr); return 1; // ubfm rd, rn, #shift, #63
+		case OP_ASR_IMM: word = 0x9340fc00 | (unsigned) (instr.imm & 63) << 16 | registerFields(instr); return 1; // sbfm
+		case OP_CMP: word = 0xeb00001f | registerField(instr.rm) << 16 | registerField(instr.rn) << 5; return 1; // subs xzr, rn, rm
+		case OP_CMP_IMM: // subs xzr, rn, #imm, or adds (cmn) when it's negative
+			if (!arithmeticField(instr.imm < 0 ? -instr.imm : instr.imm, field)) return 0;
+			word = (instr.imm < 0 ? 0xb100001f : 0xf100001f) | field | registerField(instr.rn) << 5;
+			return 1;
+		case OP_B: word = 0x14000000; return 1;
+		case OP_BL: word = 0x94000000; return 1;
+		case OP_BCOND: word = 0x54000000 | instr.cond; return 1;
+		case OP_CBZ: word = 0xb4000000 | registerField(instr.rn); return 1;
+		case OP_CBNZ: word = 0xb5000000 | registerField(instr.rn); return 1;
+		case OP_TBZ:
+		case OP_TBNZ: {
+			unsigned bit = instr.imm & 63;
+			word = (instr.op == OP_TBZ ? 0x36000000 : 0x37000000) | (bit >> 5) << 31 | (bit & 31) << 19 | registerField(instr.rn);
+			return 1;
+		}
+		case OP_RET: word = 0xd65f03c0; return 1;
+		case OP_ADR: word = 0x10000000 | registerField(instr.rd); return 1;
+		case OP_LDR_LITERAL: word = 0x58000000 | registerField(instr.rd); return 1;
+		case OP_LDR: return memoryWord(instr, 0xf9400000, 0xf8400000, 8, word);
+		case OP_STR: return memoryWord(instr, 0xf9000000, 0xf8000000, 8, word);
+		case OP_LDRB: return memoryWord(instr, 0x39400000, 0x38400000, 1, word);
+		case OP_STRB: return memoryWord(instr, 0x39000000, 0x38000000, 1, word);
+		case OP_LDRH: return memoryWord(instr, 0x79400000, 0x78400000, 2, word);
+		case OP_STRH: return memoryWord(instr, 0x79000000, 0x78000000, 2, word);
+		case OP_LDP: return pairWord(instr, 0xa9400000, word);
+		case OP_STP: return pairWord(instr, 0xa9000000, word);
+		case OP_SVC: word = 0xd4000001 | ((unsigned) instr.imm & 0xffff) << 5; return 1;
+		default:
+			return 0;
+	}
+}
+
+// 1 for the instructions whose word has a displacement to a label in it
+int hasDisplacement(OPCODE op) {
+	return isConditionalBranch(op) || op == OP_B || op == OP_BL || op == OP_ADR || op == OP_LDR_LITERAL;
+}
+
+// Puts the distance from the instruction to its target in its word, 0 when it's out of reach
+int setDisplacement(unsigned& word, OPCODE op, long long bytes) {
+	if (op == OP_ADR) {
+		if (bytes < -(1LL << 20) || bytes >= (1LL << 20)) return 0;
+		word |= ((unsigned) bytes & 3) << 29 | ((unsigned) (bytes >> 2) & 0x7ffff) << 5;
+		return 1;
+	}
+
+	if (bytes % 4 != 0) return 0;
+	long long words = bytes / 4;
+
+	if (op == OP_B || op == OP_BL) {
+		if (words < -(1LL << 25) || words >= (1LL << 25)) return 0;
+		word |= (unsigned) words & 0x3ffffff;
+	} else if (op == OP_TBZ || op == OP_TBNZ) {
+		if (words < -(1LL << 13) || words >= (1LL << 13)) return 0;
+		word |= ((unsigned) words & 0x3fff) << 5;
+	} else { // b.cond, cbz, cbnz and ldr of a literal
+		if (words < -(1LL << 18) || words >= (1LL << 18)) return 0;
+		word |= ((unsigned) words & 0x7ffff) << 5;
+	}
+	return 1;
+}
+
+#endif
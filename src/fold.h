@@ -0,0 +1,224 @@
+#include "ir.h"
+
+#ifndef FOLD_H
+#define FOLD_H
+using namespace std;
+
+// Constant folder :
+/*
+	Rewrites expressions in the IR before code generation. Operations on two
+	integer NUMBERs become a NUMBER, worked out the way the instructions would
+	on a 64 bit register (wrapping around, sdiv rounding towards zero and
+	giving 0 for a zero divisor, and % being the unsigned remainder the udiv
+	and msub pair gives). Constants in a chain like x + 1 + 2 are combined,
+	and the identities x + 0, x - 0, x * 1, x * 0, x / 1, x % 1 are removed.
+	Multiplying by a power of two becomes a shift and % by a power of two an
+	and. Nodes are rewritten in place, so parents and argument chains never
+	need updating.
+*/
+class ConstantFolder {
+	public:
+		ConstantFolder(IrProgram& inputIr);
+		void program();
+		void block(int id);
+		void expression(int id);
+		void replace(int id, int with);
+		void setNumber(int id, unsigned long long value);
+		int isNumber(int id, unsigned long long value);
+		static int powerOfTwo(unsigned long long value);
+
+		IrProgram& ir;
+};
+
+ConstantFolder::ConstantFolder(IrProgram& inputIr) : ir(inputIr) {
+}
+
+void ConstantFolder::program() {
+	block(ir.main);
+}
+
+void ConstantFolder::block(int id) {
+	for (; id != -1; id = ir.node(id).next) {
+		IrNode& node = ir.node(id);
+
+		switch (node.op) {
+			case IR_IF:
+				expression(ir.node(node.a).a); // conditions compare two expressions
+				expression(ir.node(node.a).b);
+				block(node.b);
+				block(node.c);
+				break;
+			case IR_WHILE:
+				expression(ir.node(node.a).a);
+				expression(ir.node(node.a).b);
+				block(node.b);
+				break;
+			case IR_ASSIGN:
+			case IR_ASSIGN_LOCAL:
+				expression(node.b);
+				break;
+			case IR_CALL:
+				for (int arg = node.b; arg != -1; arg = ir.node(arg).next) {
+					expression(arg);
+				}
+				break;
+			case IR_PRINT_VALUE:
+				expression(node.a);
+				if (ir.isInteger(node.a)) { // known already, so it's printed as a literal
+					node.a = ir.stringLiterals.insert(to_string(ir.node(node.a).value));
+					node.op = IR_PRINT;
+				}
+				break;
+			case IR_FUNC:
+				block(node.b);
+				break;
+			default:
+				break;
+		}
+	}
+}
+
+// Copies node with over node id, keeping id's place in any chain
+void ConstantFolder::replace(int id, int with) {
+	int next = ir.node(id).next;
+	ir.nodes[id] = ir.nodes[with];
+	ir.nodes[id].next = next;
+}
+
+void ConstantFolder::setNumber(int id, unsigned long long value) {
+	IrNode& node = ir.node(id);
+	node.op = IR_NUMBER;
+	node.a = -1; // no source text, the value is written out instead
+	node.b = -1;
+	node.value = (long long) value;
+}
+
+// 1 when id is an integer NUMBER holding value
+int ConstantFolder::isNumber(int id, unsigned long long value) {
+	if (ir.isInteger(id) && (unsigned long long) ir.node(id).value == value) return 1;
+	else return 0;
+}
+
+// The shift that makes value, -1 when value isn't a power of two
+int ConstantFolder::powerOfTwo(unsigned long long value) {
+	if (value == 0 || (value & (value - 1)) != 0) return -1;
+	return __builtin_ctzll(value);
+}
+
+void ConstantFolder::expression(int id) {
+	IrNode& node = ir.node(id);
+
+	if (node.op == IR_NUMBER || node.op == IR_VAR || node.op == IR_PARAM || node.op == IR_LOCAL) return;
+
+	expression(node.a);
+	if (node.b != -1) expression(node.b);
+
+	if (node.op == IR_NEG) {
+		if (ir.isInteger(node.a)) setNumber(id, 0 - (unsigned long long) ir.node(node.a).value);
+		return;
+	}
+
+	if (node.op == IR_SHL || node.op == IR_AND) return;
+
+	int a = node.a;
+	int b = node.b;
+	unsigned long long x = ir.node(a).value;
+	unsigned long long y = ir.node(b).value;
+
+	if (ir.isInteger(a) && ir.isInteger(b)) {
+		switch (node.op) {
+			case IR_ADD: setNumber(id, x + y); break;
+			case IR_SUB: setNumber(id, x - y); break;
+			case IR_MUL: setNumber(id, x * y); break;
+			case IR_DIV:
+				if (y == 0) setNumber(id, 0);
+				else if ((long long) y == -1) setNumber(id, 0 - x); // also covers the most negative number
+				else setNumber(id, (unsigned long long) ((long long) x / (long long) y));
+				break;
+			case IR_MOD:
+				if (y == 0) setNumber(id, x);
+				else setNumber(id, x % y);
+				break;
+			default:
+				break;
+		}
+		return;
+	}
+
+	switch (node.op) {
+		case IR_ADD:
+		case IR_SUB:
+			if (ir.isInteger(b) && (ir.node(a).op == IR_ADD || ir.node(a).op == IR_SUB) && ir.isInteger(ir.node(a).b)) { // (x +- c) +- d is x + (+-c +- d)
+				unsigned long long inner = ir.node(ir.node(a).b).value;
+				unsigned long long total = (ir.node(a).op == IR_ADD ? inner : 0 - inner);
+				total = (node.op == IR_ADD ? total + y : total - y);
+
+				node.op = IR_ADD;
+				node.a = ir.node(a).a;
+				setNumber(b, total);
+				a = node.a;
+				y = total;
+			}
+
+			if (isNumber(b, 0)) replace(id, a);
+			else if (node.op == IR_ADD && isNumber(a, 0)) replace(id, b);
+			break;
+		case IR_MUL: {
+			if (ir.isInteger(a)) { // keep the constant on the right
+				node.a = b;
+				node.b = a;
+				swap(a, b);
+				y = x;
+			}
+			if (!ir.isInteger(b)) break;
+
+			if (ir.node(a).op == IR_MUL && ir.isInteger(ir.node(a).b)) { // (x * c) * d is x * (c * d)
+				y *= ir.node(ir.node(a).b).value;
+				node.a = ir.node(a).a;
+				setNumber(b, y);
+				a = node.a;
+			} else if (ir.node(a).op == IR_SHL) { // an inner multiply already turned into a shift
+				y <<= ir.node(a).value;
+				node.a = ir.node(a).a;
+				setNumber(b, y);
+				a = node.a;
+			}
+
+			int shift = powerOfTwo(y);
+
+			if (y == 0) {
+				setNumber(id, 0);
+			} else if (y == 1) {
+				replace(id, a);
+			} else if (shift != -1) {
+				node.op = IR_SHL;
+				node.b = -1;
+				node.value = shift;
+			}
+			break;
+		}
+		case IR_DIV:
+			if (isNumber(b, 1)) replace(id, a);
+			break;
+		case IR_MOD: {
+			if (!ir.isInteger(b)) break;
+
+			int shift = powerOfTwo(y);
+
+			if (y == 0) {
+				replace(id, a);
+			} else if (y == 1) {
+				setNumber(id, 0);
+			} else if (shift != -1) { // the remainder is unsigned, so it's just the low bits
+				node.op = IR_AND;
+				node.b = -1;
+				node.value = y - 1;
+			}
+			break;
+		}
+		default:
+			break;
+	}
+}
+
+#endif
@@ -0,0 +1,136 @@
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdio>
+#include <climits>
+
+#include "instr.h"
+
+#ifndef IMMEDIATE_H
+#define IMMEDIATE_H
+using namespace std;
+
+// Immediates :
+/*
+	ARM64 instructions are 32 bits wide, so a constant only fits in one when
+	it has a particular shape: a 16 bit chunk for movz, the inverse of one for
+	movn, or a "bitmask", a rotated run of ones repeated across the register,
+	for orr and the other logical instructions. Anything else is built a chunk
+	at a time with movk. A single movz or movn with no shift is written as a
+	plain mov.
+*/
+
+// Rotates the low size bits of value right by amount
+unsigned long long rotateRight(unsigned long long value, int amount, int size) {
+	unsigned long long mask = (size == 64) ? ~0ULL : (1ULL << size) - 1;
+	if (amount == 0) return value & mask;
+	return ((value >> amount) | (value << (size - amount))) & mask;
+}
+
+// Returns 1 when value is a bitmask immediate, and sets encoding to its N:immr:imms bits
+int logicalImmediate(unsigned long long value, unsigned& encoding) {
+	if (value == 0 || value == ~0ULL) return 0; // the only patterns that can't be encoded
+
+	int size = 64;
+	while (size > 2) { // smallest element the value repeats
+		int half = size / 2;
+		unsigned long long mask = (1ULL << half) - 1;
+		if ((value & mask) != ((value >> half) & mask)) break;
+		size = half;
+	}
+
+	unsigned long long element = (size == 64) ? value : value & ((1ULL << size) - 1);
+	int ones = __builtin_popcountll(element);
+	unsigned long long run = (1ULL << ones) - 1;
+
+	for (int rotation = 0; rotation < size; rotation++) {
+		if (rotateRight(run, rotation, size) == element) {
+			unsigned n = (size == 64) ? 1 : 0;
+			unsigned imms = ((~(size - 1) << 1) | (ones - 1)) & 0x3f;
+			encoding = (n << 12) | (rotation << 6) | imms;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int logicalImmediate(unsigned long long value) {
+	unsigned encoding;
+	return logicalImmediate(value, encoding);
+}
+
+// 1 when value fits the 12 bit immediate of add, sub and cmp, optionally shifted left by 12. Negative values fit the opposite instruction
+int arithmeticImmediate(long long value) {
+	if (value < 0) {
+		if (value == LLONG_MIN) return 0;
+		value = -value;
+	}
+	if (value < 4096) return 1;
+	if ((value & 0xfff) == 0 && value < (4096LL << 12)) return 1;
+	return 0;
+}
+
+// 16 bit chunk of value at shift
+unsigned chunk(unsigned long long value, int shift) {
+	return (value >> shift) & 0xffff;
+}
+
+Instr makeWideInstr(OPCODE op, int reg, unsigned part, int shift) { // movz, movn or movk
+	Instr instr = makeInstr(op, reg, -1, -1, part);
+	instr.mode = shift;
+	return instr;
+}
+
+// Adds the instructions that put value in reg to out, as few as it can be done in
+void immediateInstrs(int reg, unsigned long long value, vector<Instr>& out) {
+	int zeros = 0;
+	int ones = 0;
+	for (int shift = 0; shift < 64; shift += 16) {
+		if (chunk(value, shift) == 0) zeros++;
+		if (chunk(value, shift) == 0xffff) ones++;
+	}
+
+	// starting with movn sets every other chunk to ffff, starting with movz sets them to 0
+	int inverted = ones > zeros;
+	unsigned skip = inverted ? 0xffff : 0;
+	int needed = 4 - (inverted ? ones : zeros);
+
+	if (needed > 1 && logicalImmediate(value)) {
+		out.push_back(makeInstr(OP_ORR_IMM, reg, REG_XZR, -1, value));
+		return;
+	}
+
+	if (needed > 2) { // a bitmask with one chunk patched can do it in two
+		for (int shift = 0; shift < 64; shift += 16) {
+			unsigned long long without = value & ~(0xffffULL << shift);
+			for (int other = 0; other < 64; other += 16) {
+				unsigned long long patched = without | ((unsigned long long) chunk(value, other) << shift);
+				for (unsigned long long candidate : {without, without | (0xffffULL << shift), patched}) {
+					if (logicalImmediate(candidate)) {
+						out.push_back(makeInstr(OP_ORR_IMM, reg, REG_XZR, -1, candidate));
+						out.push_back(makeWideInstr(OP_MOVK, reg, chunk(value, shift), shift));
+						return;
+					}
+				}
+			}
+		}
+	}
+
+	if (needed == 0) { // 0 or all ones
+		out.push_back(makeWideInstr(inverted ? OP_MOVN : OP_MOVZ, reg, 0, 0));
+		return;
+	}
+
+	int first = 1;
+	for (int shift = 0; shift < 64; shift += 16) {
+		unsigned part = chunk(value, shift);
+		if (part == skip) continue;
+
+		if (first && inverted) out.push_back(makeWideInstr(OP_MOVN, reg, ~part & 0xffff, shift));
+		else if (first) out.push_back(makeWideInstr(OP_MOVZ, reg, part, shift));
+		else out.push_back(makeWideInstr(OP_MOVK, reg, part, shift));
+		first = 0;
+	}
+}
+
+#endif
@@ -0,0 +1,582 @@
+#include <string>
+#include <string_view>
+#include <vector>
+#include <charconv>
+#include <cstdio>
+
+#include "nametable.h"
+
+#ifndef INSTR_H
+#define INSTR_H
+using namespace std;
+
+// Instructions :
+/*
+	The code generator builds each section as a list of Instr structs rather
+	than text, so passes like the peephole optimizer can look at registers and
+	labels directly. Registers are numbered 0 - 30 for x0 - x30, with REG_SP
+	and REG_XZR for the two meanings of register 31. Labels are ids in a
+	NameTable. Text is only made when a list is rendered for the emitter.
+*/
+enum OPCODE : unsigned char {
+	OP_LABEL,	// label:
+	OP_MOV,		// mov rd, rn
+	OP_MOVZ,	// movz rd, #imm, lsl #shift, or mov rd, #<label's text> for numbers kept as written
+	OP_MOVN,
+	OP_MOVK,
+	OP_ORR_IMM,	// orr rd, rn, #imm
+	OP_AND_IMM,
+	OP_ADD,		// add rd, rn, rm
+	OP_SUB,
+	OP_ADD_IMM,	// add rd, rn, #imm
+	OP_SUB_IMM,
+	OP_MUL,
+	OP_SMULH,	// smulh rd, rn, rm, high half of the signed product
+	OP_UMULH,
+	OP_SDIV,
+	OP_UDIV,
+	OP_MSUB,	// msub rd, rn, rm, ra
+	OP_CSEL,	// csel rd, rn, rm, cond
+	OP_CSINC,	// csinc rd, rn, rm, cond
+	OP_NEG,		// neg rd, rm
+	OP_LSL_IMM,	// lsl rd, rn, #imm
+	OP_LSR_IMM,
+	OP_ASR_IMM,
+	OP_CMP,		// cmp rn, rm
+	OP_CMP_IMM,	// cmp rn, #imm, cmn for a negative imm
+	OP_B,		// b label
+	OP_BCOND,	// b.cond label
+	OP_CBZ,		// cbz rn, label
+	OP_CBNZ,
+	OP_TBZ,		// tbz rn, #imm, label
+	OP_TBNZ,
+	OP_BL,
+	OP_RET,
+	OP_ADR,		// adr rd, label
+	OP_LDR_LITERAL,	// ldr rd, =label, or =imm when label is -1
+	OP_LDR,		// ldr rd, [rn, #imm], addressed by mode
+	OP_STR,
+	OP_LDP,		// ldp rd, rm, [rn, #imm]
+	OP_STP,
+	OP_LDRB,	// ldrb wd, [rn, #imm], a single byte, addressed by mode
+	OP_STRB,
+	OP_LDRH,	// ldrh wd, [rn, #imm], two bytes
+	OP_STRH,
+	OP_SVC,
+	OP_LTORG,	// literal pool
+	OP_NOP		// removed, never rendered
+};
+
+enum CONDITION : unsigned char { // in the encoding's order
+	COND_EQ, COND_NE, COND_HS, COND_LO, COND_MI, COND_PL, COND_VS, COND_VC,
+	COND_HI, COND_LS, COND_GE, COND_LT, COND_GT, COND_LE, COND_AL
+};
+
+enum ADDRESS_MODE : unsigned char {
+	ADDRESS_OFFSET,	// [rn, #imm]
+	ADDRESS_PRE,	// [rn, #imm]!
+	ADDRESS_POST	// [rn], #imm
+};
+
+const int REG_FP = 29;
+const int REG_LR = 30;
+const int REG_SP = 31;
+const int REG_XZR = 32;
+
+struct Instr {
+	OPCODE op;
+	unsigned char cond;	// OP_BCOND, OP_CSEL and OP_CSINC
+	unsigned char mode;	// ADDRESS_MODE of loads and stores, the shift of movz, movn and movk
+	signed char rd;
+	signed char rn;
+	signed char rm;
+	signed char ra;
+	int label;
+	long long imm;
+};
+
+Instr makeInstr(OPCODE op, int rd = -1, int rn = -1, int rm = -1, long long imm = 0) {
+	return {op, COND_AL, 0, (signed char) rd, (signed char) rn, (signed char) rm, -1, -1, imm};
+}
+
+Instr makeLabelInstr(OPCODE op, int label, int rd = -1) { // labels, branches, adr and ldr =label
+	Instr instr = makeInstr(op, rd);
+	instr.label = label;
+	return instr;
+}
+
+Instr makeMemoryInstr(OPCODE op, int rd, int rn, long long offset, ADDRESS_MODE mode = ADDRESS_OFFSET, int rm = -1) {
+	Instr instr = makeInstr(op, rd, rn, rm, offset);
+	instr.mode = mode;
+	return instr;
+}
+
+CONDITION invertCondition(CONDITION cond) { // conditions come in pairs that differ in the lowest bit
+	return (CONDITION) (cond ^ 1);
+}
+
+// b.cond, cbz, cbnz, tbz and tbnz
+int isConditionalBranch(OPCODE op) {
+	if (op == OP_BCOND || op == OP_CBZ || op == OP_CBNZ || op == OP_TBZ || op == OP_TBNZ) return 1;
+	else return 0;
+}
+
+// 1 for anything that ends a basic block
+int isBranch(OPCODE op) {
+	if (op == OP_B || op == OP_RET || isConditionalBranch(op)) return 1;
+	else return 0;
+}
+
+// Turns a conditional branch into the one taken exactly when it wasn't
+void invertBranch(Instr& instr) {
+	switch (instr.op) {
+		case OP_BCOND: instr.cond = invertCondition((CONDITION) instr.cond); break;
+		case OP_CBZ: instr.op = OP_CBNZ; break;
+		case OP_CBNZ: instr.op = OP_CBZ; break;
+		case OP_TBZ: instr.op = OP_TBNZ; break;
+		case OP_TBNZ: instr.op = OP_TBZ; break;
+		default: break;
+	}
+}
+
+// Bytes either way a conditional branch can reach
+long long branchRange(OPCODE op) {
+	if (op == OP_TBZ || op == OP_TBNZ) return 32 * 1024;
+	else return 1024 * 1024;
+}
+
+// Whether instr reads reg. The flags aren't a register, nothing the optimizers do moves an instruction past another
+int readsRegister(const Instr& instr, int reg) {
+	switch (instr.op) {
+		case OP_MOV:
+		case OP_ORR_IMM:
+		case OP_AND_IMM:
+		case OP_ADD_IMM:
+		case OP_SUB_IMM:
+		case OP_LSL_IMM:
+		case OP_LSR_IMM:
+		case OP_ASR_IMM:
+		case OP_LDR:
+		case OP_LDP:
+		case OP_LDRB:
+		case OP_LDRH:
+		case OP_CMP_IMM:
+		case OP_CBZ:
+		case OP_CBNZ:
+		case OP_TBZ:
+		case OP_TBNZ:
+			return instr.rn == reg;
+		case OP_MOVK:
+			return instr.rd == reg;
+		case OP_ADD:
+		case OP_SUB:
+		case OP_MUL:
+		case OP_SMULH:
+		case OP_UMULH:
+		case OP_SDIV:
+		case OP_UDIV:
+		case OP_CMP:
+		case OP_CSEL:
+		case OP_CSINC:
+			return instr.rn == reg || instr.rm == reg;
+		case OP_MSUB:
+			return instr.rn == reg || instr.rm == reg || instr.ra == reg;
+		case OP_NEG:
+			return instr.rm == reg;
+		case OP_STR:
+		case OP_STRB:
+		case OP_STRH:
+			return instr.rd == reg || instr.rn == reg;
+		case OP_STP:
+			return instr.rd == reg || instr.rm == reg || instr.rn == reg;
+		case OP_BL:
+			return reg < 8; // arguments
+		case OP_SVC:
+			return reg <= 8; // system call arguments and number
+		case OP_RET:
+			return reg == REG_LR;
+		default:
+			return 0;
+	}
+}
+
+// Whether instr changes reg
+int writesRegister(const Instr& instr, int reg) {
+	switch (instr.op) {
+		case OP_MOV:
+		case OP_MOVZ:
+		case OP_MOVN:
+		case OP_MOVK:
+		case OP_ORR_IMM:
+		case OP_AND_IMM:
+		case OP_ADD:
+		case OP_SUB:
+		case OP_ADD_IMM:
+		case OP_SUB_IMM:
+		case OP_MUL:
+		case OP_SMULH:
+		case OP_UMULH:
+		case OP_SDIV:
+		case OP_UDIV:
+		case OP_MSUB:
+		case OP_CSEL:
+		case OP_CSINC:
+		case OP_NEG:
+		case OP_LSL_IMM:
+		case OP_LSR_IMM:
+		case OP_ASR_IMM:
+		case OP_ADR:
+		case OP_LDR_LITERAL:
+			return instr.rd == reg;
+		case OP_LDR:
+		case OP_LDRB:
+		case OP_LDRH:
+			return instr.rd == reg || (instr.mode != ADDRESS_OFFSET && instr.rn == reg);
+		case OP_LDP:
+			return instr.rd == reg || instr.rm == reg || (instr.mode != ADDRESS_OFFSET && instr.rn == reg);
+		case OP_STR:
+		case OP_STP:
+		case OP_STRB:
+		case OP_STRH:
+			return instr.mode != ADDRESS_OFFSET && instr.rn == reg;
+		case OP_BL:
+			return reg <= 18 || reg == REG_LR; // everything a callee doesn't have to keep
+		case OP_SVC:
+			return reg == 0;
+		default:
+			return 0;
+	}
+}
+
+// 1 for instructions that only compute rd from their operands, which can be moved or dropped
+int isPure(const Instr& instr) {
+	switch (instr.op) {
+		case OP_MOV:
+		case OP_MOVZ:
+		case OP_MOVN:
+		case OP_ORR_IMM:
+		case OP_AND_IMM:
+		case OP_ADD:
+		case OP_SUB:
+		case OP_ADD_IMM:
+		case OP_SUB_IMM:
+		case OP_MUL:
+		case OP_SMULH:
+		case OP_UMULH:
+		case OP_SDIV:
+		case OP_UDIV:
+		case OP_MSUB:
+		case OP_CSEL:
+		case OP_CSINC:
+		case OP_NEG:
+		case OP_LSL_IMM:
+		case OP_LSR_IMM:
+		case OP_ASR_IMM:
+		case OP_ADR:
+		case OP_LDR_LITERAL:
+			return instr.rd != REG_SP;
+		case OP_LDR:
+			return instr.mode == ADDRESS_OFFSET;
+		default:
+			return 0;
+	}
+}
+
+// 1 where straight line code ends: labels, jumps, calls and anything else after which registers can't be followed
+int isBoundary(const Instr& instr) {
+	switch (instr.op) {
+		case OP_LABEL:
+		case OP_B:
+		case OP_BCOND:
+		case OP_CBZ:
+		case OP_CBNZ:
+		case OP_TBZ:
+		case OP_TBNZ:
+		case OP_BL:
+		case OP_RET:
+		case OP_SVC:
+		case OP_LTORG:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+// Registers the code generator only uses within a statement, so nothing is left in them at a boundary
+int isScratch(int reg) {
+	if (reg >= 8 && reg <= 15) return 1;
+	else return 0;
+}
+
+// Instruction list :
+/*
+	One section's instructions, along with the table their labels come from.
+*/
+class InstrList {
+	public:
+		InstrList(NameTable& labelTable);
+		void add(const Instr& instr);
+		void render(string& out);
+		void renderInstr(const Instr& instr, string& out);
+		void renderRegister(int reg, string& out);
+		void renderImmediate(long long value, string& out);
+		void renderAddress(const Instr& instr, string& out);
+		size_t size();
+		void clear();
+
+		NameTable& labels;
+		vector<Instr> instrs;
+};
+
+InstrList::InstrList(NameTable& labelTable) : labels(labelTable) {
+}
+
+void InstrList::add(const Instr& instr) {
+	instrs.push_back(instr);
+}
+
+size_t InstrList::size() {
+	return instrs.size();
+}
+
+void InstrList::clear() {
+	instrs.clear();
+}
+
+void InstrList::renderRegister(int reg, string& out) {
+	if (reg == REG_FP) out += "fp";
+	else if (reg == REG_LR) out += "lr";
+	else if (reg == REG_SP) out += "sp";
+	else if (reg == REG_XZR) out += "xzr";
+	else {
+		out += 'x';
+		out += to_string(reg);
+	}
+}
+
+void InstrList::renderImmediate(long long value, string& out) {
+	char text[24];
+	auto end = to_chars(text, text + sizeof(text), value).ptr;
+	out += '#';
+	out.append(text, end - text);
+}
+
+// [rn, #imm], [rn, #imm]! or [rn], #imm
+void InstrList::renderAddress(const Instr& instr, string& out) {
+	out += '[';
+	renderRegister(instr.rn, out);
+
+	if (instr.mode == ADDRESS_POST) {
+		out += "], ";
+		renderImmediate(instr.imm, out);
+		return;
+	}
+
+	if (instr.imm != 0 || instr.mode == ADDRESS_PRE) {
+		out += ", ";
+		renderImmediate(instr.imm, out);
+	}
+	out += ']';
+	if (instr.mode == ADDRESS_PRE) out += '!';
+}
+
+// Appends the assembly for every instruction, one per line
+void InstrList::render(string& out) {
+	for (const Instr& instr : instrs) {
+		if (instr.op == OP_NOP) continue;
+		renderInstr(instr, out);
+		out += '\n';
+	}
+}
+
+void InstrList::renderInstr(const Instr& instr, string& out) {
+	static const char* const names[] = {
+		"", "mov", "movz", "movn", "movk", "orr", "and", "add", "sub", "add", "sub",
+		"mul", "smulh", "umulh", "sdiv", "udiv", "msub", "csel", "csinc", "neg", "lsl", "lsr", "asr", "cmp", "cmp",
+		"b", "b", "cbz", "cbnz", "tbz", "tbnz", "bl", "ret",
+		"adr", "ldr", "ldr", "str", "ldp", "stp", "ldrb", "strb", "ldrh", "strh", "svc", ".ltorg", ""
+	};
+	static const char* const conditions[] = {
+		"eq", "ne", "hs", "lo", "mi", "pl", "vs", "vc", "hi", "ls", "ge", "lt", "gt", "le", "al"
+	};
+
+	switch (instr.op) {
+		case OP_LABEL:
+			out += labels.names[instr.label];
+			out += ':';
+			return;
+		case OP_MOVZ:
+		case OP_MOVN:
+			if (instr.mode == 0) { // the plain mov form, as the assembler would take it
+				out += "mov ";
+				renderRegister(instr.rd, out);
+				out += ", ";
+				if (instr.label != -1) { // written as it was in the source
+					out += '#';
+					out += labels.names[instr.label];
+					return;
+				}
+				renderImmediate(instr.op == OP_MOVZ ? instr.imm : ~instr.imm, out);
+				return;
+			}
+			[[fallthrough]];
+		case OP_MOVK: {
+			char text[24];
+			snprintf(text, sizeof(text), "#0x%llx", (unsigned long long) instr.imm);
+
+			out += names[instr.op];
+			out += ' ';
+			renderRegister(instr.rd, out);
+			out += ", ";
+			out += text;
+			if (instr.mode != 0) {
+				out += ", lsl #";
+				out += to_string(instr.mode);
+			}
+			return;
+		}
+		case OP_ORR_IMM:
+		case OP_AND_IMM: {
+			char text[24];
+			snprintf(text, sizeof(text), "#0x%llx", (unsigned long long) instr.imm);
+
+			out += names[instr.op];
+			out += ' ';
+			renderRegister(instr.rd, out);
+			out += ", ";
+			renderRegister(instr.rn, out);
+			out += ", ";
+			out += text;
+			return;
+		}
+		case OP_BCOND:
+			out += 'b';
+			out += conditions[instr.cond];
+			out += ' ';
+			out += labels.names[instr.label];
+			return;
+		case OP_B:
+		case OP_BL:
+			out += names[instr.op];
+			out += ' ';
+			out += labels.names[instr.label];
+			return;
+		case OP_CBZ:
+		case OP_CBNZ:
+		case OP_TBZ:
+		case OP_TBNZ:
+			out += names[instr.op];
+			out += ' ';
+			renderRegister(instr.rn, out);
+			out += ", ";
+			if (instr.op == OP_TBZ || instr.op == OP_TBNZ) {
+				renderImmediate(instr.imm, out);
+				out += ", ";
+			}
+			out += labels.names[instr.label];
+			return;
+		case OP_CMP_IMM:
+			out += (instr.imm < 0) ? "cmn " : "cmp ";
+			renderRegister(instr.rn, out);
+			out += ", ";
+			renderImmediate(instr.imm < 0 ? -instr.imm : instr.imm, out);
+			return;
+		case OP_RET:
+		case OP_LTORG:
+			out += names[instr.op];
+			return;
+		case OP_SVC:
+			out += "svc ";
+			renderImmediate(instr.imm, out);
+			return;
+		case OP_ADR:
+			out += "adr ";
+			renderRegister(instr.rd, out);
+			out += ", ";
+			out += labels.names[instr.label];
+			return;
+		case OP_LDR_LITERAL:
+			out += "ldr ";
+			renderRegister(instr.rd, out);
+			out += ", =";
+			if (instr.label != -1) out += labels.names[instr.label];
+			else out += to_string(instr.imm);
+			return;
+		case OP_LDR:
+		case OP_STR:
+			out += names[instr.op];
+			out += ' ';
+			renderRegister(instr.rd, out);
+			out += ", ";
+			renderAddress(instr, out);
+			return;
+		case OP_LDRB:
+		case OP_STRB:
+		case OP_LDRH:
+		case OP_STRH: // bytes go through the low 32 bits of the register
+			out += names[instr.op];
+			out += ' ';
+			if (instr.rd == REG_XZR) out += "wzr";
+			else {
+				out += 'w';
+				out += to_string(instr.rd);
+			}
+			out += ", ";
+			renderAddress(instr, out);
+			return;
+		case OP_LDP:
+		case OP_STP:
+			out += names[instr.op];
+			out += ' ';
+			renderRegister(instr.rd, out);
+			out += ", ";
+			renderRegister(instr.rm, out);
+			out += ", ";
+			renderAddress(instr, out);
+			return;
+		default:
+			break;
+	}
+
+	// register operands, then an immediate for the _IMM forms
+	out += names[instr.op];
+	out += ' ';
+
+	if (instr.op == OP_CMP) {
+		renderRegister(instr.rn, out);
+		out += ", ";
+		renderRegister(instr.rm, out);
+		return;
+	}
+
+	renderRegister(instr.rd, out);
+
+	if (instr.op == OP_NEG) {
+		out += ", ";
+		renderRegister(instr.rm, out);
+		return;
+	}
+
+	out += ", ";
+	renderRegister(instr.rn, out);
+
+	if (instr.op == OP_MOV) return;
+
+	out += ", ";
+	if (instr.op == OP_ADD_IMM || instr.op == OP_SUB_IMM || instr.op == OP_LSL_IMM || instr.op == OP_LSR_IMM || instr.op == OP_ASR_IMM) {
+		renderImmediate(instr.imm, out);
+		return;
+	}
+
+	renderRegister(instr.rm, out);
+
+	if (instr.op == OP_MSUB) {
+		out += ", ";
+		renderRegister(instr.ra, out);
+	} else if (instr.op == OP_CSEL || instr.op == OP_CSINC) {
+		out += ", ";
+		out += conditions[instr.cond];
+	}
+}
+
+#endif
@@ -0,0 +1,280 @@
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cctype>
+#include <algorithm>
+
+#include "nametable.h"
+#include "lexer.h"
+
+#ifndef IR_H
+#define IR_H
+using namespace std;
+
+const int MAX_LOCALS = 4000; // local offsets have to fit a scaled 12 bit ldr/str offset
+const int ARGUMENT_REGISTERS = 8; // x0 - x7 carry the first arguments of a call
+
+// Function scope :
+/*
+	Built while parsing a FUNC. Each parameter gets a slot, its position in
+	the USING list, and the body is parsed with a reference to the scope, so
+	looking up a parameter is a hash lookup with nothing copied. Variables
+	declared in the body are locals, with slots of their own in the function's
+	stack frame, so every call gets its own copy.
+*/
+class FunctionScope {
+	public:
+		FunctionScope() {
+			function = -1;
+		}
+
+		int slot(string_view name) const { // slot of a parameter, -1 if the name isn't one
+			return params.find(name);
+		}
+
+		int size() const {
+			return params.size();
+		}
+
+		int local(string_view name) const { // slot of a local, -1 if the name isn't one
+			return locals.find(name);
+		}
+
+		int addLocal(string_view name, TOKEN_TYPE type) {
+			int slot = locals.insert(name);
+			localTypes.push_back(type);
+			return slot;
+		}
+
+		int registerParams() const { // parameters that arrive in x0 - x7
+			return min(size(), ARGUMENT_REGISTERS);
+		}
+
+		int frameSize() const { // bytes for the register parameters and the locals, kept 16 aligned like sp
+			return ((registerParams() + locals.size()) * 8 + 15) & ~15;
+		}
+
+		/*	TOP						BOT
+		 *
+		 *	p9 p8 | [-] l1 l0 p7 p6 ... p1 p0 lr fp|fp	10 params, 2 locals
+		 *	caller | this function's frame
+		 *
+		 *	The first eight parameters come in x0 - x7 and are saved right
+		 *	above fp on entry, the locals follow them. The rest stay where
+		 *	the caller put them, just above the frame.
+		 */
+		int getParamOffset(int slot) const {
+			if (slot < ARGUMENT_REGISTERS) return 16 + slot * 8;
+			return 16 + frameSize() + (slot - ARGUMENT_REGISTERS) * 8;
+		}
+
+		int getLocalOffset(int slot) const {
+			return 16 + (registerParams() + slot) * 8;
+		}
+
+		int function; // id in the FunctionMap, -1 outside of functions
+		NameTable params;
+		NameTable locals;
+		vector<TOKEN_TYPE> localTypes; // declared type of each local, indexed by slot
+};
+
+FunctionScope NO_SCOPE; // used for statements outside of any function, never gets locals
+
+class FunctionMap {
+	public:
+		FunctionMap() {}
+
+		int exists(string_view name) { // helper function to figure out if an entry exists
+			if (functions.find(name) == -1) return 0;
+			else return 1;
+		}
+
+		int paramExists(string_view name, string_view param) { // check to see a param is already defined -- maybe not useful
+			if (getScope(name).slot(param) == -1) return 0;
+			else return 1;
+		}
+
+		string getLabel(string_view name) { 	// helper function to get the label for each function
+			return getLabel(functions.find(name));
+		}
+
+		string getLabel(int index) {
+			return "FUNC" + to_string(index);
+		}
+
+		const FunctionScope& getScope(string_view name) { // return the params listed under a function label
+			int id = functions.find(name);
+			if (id == -1) return NO_SCOPE;
+			return scopes[id];
+		}
+
+		FunctionScope& push_name(string_view name) { // adds the function, parameters go into the returned scope
+			int id = functions.insert(name);
+			scopes.emplace_back();
+			scopes.back().function = id;
+			return scopes.back();
+		}
+
+		vector<FunctionScope> scopes; // indexed by function id
+		NameTable functions;
+};
+
+class SymbolMap {
+	public:
+		SymbolMap() {
+		}
+
+		string getLabel(string_view name) {
+			return "V" + to_string(symbols.find(name));
+		}
+
+		string getLabel(int index) {
+			return "V" + to_string(index);
+		}
+
+		int exists(string_view name) {
+			if (symbols.find(name) == -1) return 0; // doesn't exist
+			else return 1; // exists
+		}
+
+		int find(string_view name) {
+			return symbols.find(name);
+		}
+
+		int push_back(string_view name, TOKEN_TYPE type = TOKEN_TYPE::INT) {
+			int id = symbols.insert(name);
+			types.push_back(type);
+			return id;
+		}
+
+		int isInt(int index) { // only INT variables are kept in registers
+			if (types[index] == TOKEN_TYPE::INT) return 1;
+			else return 0;
+		}
+
+		int size() {
+			return symbols.size();
+		}
+
+		NameTable symbols;
+		vector<TOKEN_TYPE> types; // declared type of each symbol, indexed by id
+};
+
+enum IR_OP : int {
+	// Expressions
+	IR_NUMBER,	// value, a = index into numberText, -1 for a folded constant
+	IR_VAR,		// a = symbol id
+	IR_PARAM,	// a = slot, b = function id
+	IR_LOCAL,	// a = slot, b = function id
+	IR_NEG,		// a
+	IR_ADD,		// a + b
+	IR_SUB,
+	IR_MUL,
+	IR_DIV,
+	IR_MOD,
+	IR_SHL,		// a << value, made from multiplying by a power of two
+	IR_AND,		// a & value, made from % by a power of two
+	// Conditions, a (op) b
+	IR_EQ,
+	IR_NE,
+	IR_GT,
+	IR_GE,
+	IR_LT,
+	IR_LE,
+	// Statements
+	IR_PRINT,	// a = string literal id
+	IR_PRINT_VALUE,	// a = expression, printed in decimal
+	IR_IF,		// a = condition, b = then block, c = else block
+	IR_WHILE,	// a = condition, b = body
+	IR_LABEL,	// a = label id
+	IR_GOTO,	// a = label id
+	IR_ASSIGN,	// a = symbol id, b = expression
+	IR_ASSIGN_LOCAL,	// a = slot, b = expression, c = function id
+	IR_CALL,	// a = function id, b = first argument, c = argument count
+	IR_FUNC		// a = function id, b = body
+};
+
+// IR node :
+/*
+	Every node is the same small struct, and they all live in one array in
+	IrProgram, pointing at each other by index. Blocks of statements and lists
+	of call arguments are chained through next, -1 marks the end of a chain and
+	an empty block.
+*/
+struct IrNode {
+	IR_OP op;
+	int a;
+	int b;
+	int c;
+	int next;
+	long long value;
+};
+
+// IR program :
+/*
+	What the parser hands the code generator: the nodes, the top-level block in
+	source order (FUNC definitions included, where they appeared), and the name
+	tables the labels come from.
+*/
+class IrProgram {
+	public:
+		IrProgram();
+		int add(IR_OP op, int a = -1, int b = -1, int c = -1);
+		int number(string_view text);
+		void append(int& first, int& last, int id);
+		IrNode& node(int id);
+		int isInteger(int id);
+
+		vector<IrNode> nodes;
+		vector<string_view> numberText; // NUMBER tokens as written, they point into the source
+		int main; // first top-level statement
+
+		SymbolMap symbolMap;
+		FunctionMap functionMap;
+		NameTable labels;
+		NameTable stringLiterals;
+};
+
+IrProgram::IrProgram() {
+	main = -1;
+}
+
+int IrProgram::add(IR_OP op, int a, int b, int c) {
+	nodes.push_back({op, a, b, c, -1, 0});
+	return nodes.size() - 1;
+}
+
+// NUMBER node. The value wraps around like a 64 bit register, the text is kept for the assembly
+int IrProgram::number(string_view text) {
+	unsigned long long value = 0;
+	for (char c : text) {
+		if (!isdigit(c)) break; // fractions aren't supported yet, they only keep their text
+		value = value * 10 + (c - '0');
+	}
+
+	numberText.push_back(text);
+	int id = add(IR_NUMBER, numberText.size() - 1);
+	nodes[id].value = (long long) value;
+	return id;
+}
+
+// Adds id to the end of the chain running from first to last
+void IrProgram::append(int& first, int& last, int id) {
+	if (first == -1) first = id;
+	else nodes[last].next = id;
+	last = id;
+}
+
+IrNode& IrProgram::node(int id) {
+	return nodes[id];
+}
+
+// 1 for a NUMBER node whose value is the whole number, fractions only keep their text
+int IrProgram::isInteger(int id) {
+	IrNode& found = nodes[id];
+	if (found.op != IR_NUMBER) return 0;
+	if (found.a != -1 && numberText[found.a].find('.') != string_view::npos) return 0;
+	return 1;
+}
+
+#endif
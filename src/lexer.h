@@ -1,7 +1,14 @@
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <cstdlib>
 #include <cctype>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "scan.h"
 
 using namespace std;
 
@@ -49,6 +56,8 @@ enum TOKEN_TYPE : int {
 	EQEQ,
 	NEQ,
 	COMMA,
+	LPAREN,
+	RPAREN,
 	COMMENT // #
 };
 
@@ -98,14 +107,120 @@ string tokenTypeToString(TOKEN_TYPE type) {
 		case NEQ: return "NEQ";
 		case COMMENT: return "COMMENT";
 		case COMMA: return "COMMA";
+		case LPAREN: return "LPAREN";
+		case RPAREN: return "RPAREN";
 
 		default: return "INVALID";
 	}
 }
 
+// Keyword lookup :
+/*
+	Keywords are found with a perfect hash of their first letter, last letter and
+	length, so an identifier costs one table load and one comparison. The table
+	is built at compile time, and the build fails if a new keyword collides.
+*/
+struct Keyword {
+	string_view text;
+	TOKEN_TYPE type;
+};
+
+constexpr Keyword KEYWORDS[] = {
+	{"INT", INT}, {"FLOAT", FLOAT}, {"TEXT", TEXT},
+	{"IF", IF}, {"THEN", THEN}, {"ELSE", ELSE}, {"ENDIF", ENDIF},
+	{"WHILE", WHILE}, {"DO", DO}, {"ENDWHILE", ENDWHILE},
+	{"FUNC", FUNC}, {"IS", IS}, {"USING", USING}, {"WITH", WITH}, {"ENDFUNC", ENDFUNC},
+	{"PRINT", PRINT}, {"LABEL", LABEL}, {"GOTO", GOTO}
+};
+
+constexpr int KEYWORD_TABLE_SIZE = 64;
+
+constexpr int keywordHash(string_view text) { // text is never empty, the lexer only asks about identifiers
+	return ((unsigned char) text.front() + 4 * (unsigned char) text.back() + text.length()) & (KEYWORD_TABLE_SIZE - 1);
+}
+
+struct KeywordTable {
+	Keyword slots[KEYWORD_TABLE_SIZE];
+	bool perfect;
+};
+
+constexpr KeywordTable buildKeywordTable() {
+	KeywordTable table = {};
+
+	for (int i = 0; i < KEYWORD_TABLE_SIZE; i++) table.slots[i] = {"", INVALID};
+	table.perfect = true;
+
+	for (const Keyword& keyword : KEYWORDS) {
+		Keyword& slot = table.slots[keywordHash(keyword.text)];
+		if (!slot.text.empty()) table.perfect = false;
+		slot = keyword;
+	}
+
+	return table;
+}
+
+constexpr KeywordTable KEYWORD_TABLE = buildKeywordTable();
+static_assert(KEYWORD_TABLE.perfect, "Keyword hash collision, change keywordHash");
+static_assert(sizeof(KEYWORDS) / sizeof(Keyword) == GOTO - INT + 1, "Every keyword needs an entry in KEYWORDS");
+
+// Source file mapped read-only into memory :
+/*
+	The lexer works directly on the mapping, so tokens are views into the file
+	and nothing is copied. The mapping has to outlive the lexer and parser.
+*/
+class SourceFile {
+	public:
+		SourceFile();
+		~SourceFile();
+		int open(string path);
+		string_view view();
+
+		const char* data;
+		size_t length;
+};
+
+SourceFile::SourceFile() {
+	data = "";
+	length = 0;
+}
+
+SourceFile::~SourceFile() {
+	if (length > 0) munmap((void*) data, length);
+}
+
+// Returns 1 when the file was mapped (or is empty), 0 on failure
+int SourceFile::open(string path) {
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) return 0;
+
+	struct stat info;
+	if (fstat(fd, &info) != 0) {
+		close(fd);
+		return 0;
+	}
+
+	if (info.st_size > 0) { // mmap refuses zero length mappings, an empty file just keeps the empty view
+		void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapping == MAP_FAILED) {
+			close(fd);
+			return 0;
+		}
+
+		data = (const char*) mapping;
+		length = info.st_size;
+	}
+
+	close(fd);
+	return 1;
+}
+
+string_view SourceFile::view() {
+	return string_view(data, length);
+}
+
 class Token {
 	public:
-		string text;
+		string_view text; // points into the lexer's source, never owns the text
 		TOKEN_TYPE type;
 
 		Token() {
@@ -113,50 +228,39 @@ class Token {
 			type = INVALID;
 		}
 
-		Token(string tokenText, TOKEN_TYPE tokenType) {
+		Token(string_view tokenText, TOKEN_TYPE tokenType) {
 			text = tokenText;
 			type = tokenType;
 		}
 
-		TOKEN_TYPE checkIfKeyword(string tokenText) {
-			if (tokenText == "INT") return INT;
-			else if (tokenText == "FLOAT") return FLOAT;
-			else if (tokenText == "TEXT") return TEXT;
-			else if (tokenText == "IF") return IF;
-			else if (tokenText == "THEN") return THEN;
-			else if (tokenText == "ELSE") return ELSE;
-			else if (tokenText == "ENDIF") return ENDIF;
-			else if (tokenText == "WHILE") return WHILE;
-			else if (tokenText == "DO") return DO;
-			else if (tokenText == "ENDWHILE") return ENDWHILE;
-			else if (tokenText == "LABEL") return LABEL;
-			else if (tokenText == "GOTO") return GOTO;
-			else if (tokenText == "PRINT") return PRINT;
-			else if (tokenText == "FUNC") return FUNC;
-			else if (tokenText == "IS") return IS;
-			else if (tokenText == "WITH") return WITH;
-			else if (tokenText == "USING") return USING;
-			else if (tokenText == "ENDFUNC") return ENDFUNC;
+		TOKEN_TYPE checkIfKeyword(string_view tokenText) {
+			const Keyword& slot = KEYWORD_TABLE.slots[keywordHash(tokenText)];
+
+			if (slot.text == tokenText) return slot.type;
 			else return INVALID;
 		}
 };
 
 // Lexer object :
 /*
-
+	Reads the source through a view, without copying it. The end of the buffer
+	reads as one final newline (so the last statement is always terminated),
+	followed by '\0' for the end of the file.
 */
 class Lexer {
 	public:
-		Lexer(string input);
+		Lexer(string_view input);
 		Lexer();
 		void nextChar();
+		void jumpTo(int pos);
 		char peek();
 		Token getToken();
 		void abort(string message);
 		void skipWhitespace();
 		void skipComment();
+		string_view span(int startPos);
 
-		string source;
+		string_view source;
 		int curPos;
 		char curChar;
 };
@@ -167,115 +271,137 @@ void Lexer::abort(string message) {
 }
 
 void Lexer::nextChar() {
-        curPos += 1;
-        if (curPos >= source.length()) { // end of line
-                curChar = '\0';
-        } else { // not done, get next
-                curChar = source[curPos];
-        }
+	curPos += 1;
+	if (curPos < (int) source.length()) { // not done, get next
+		curChar = source[curPos];
+	} else if (curPos == (int) source.length()) { // end of the buffer, stands in for a trailing newline
+		curChar = '\n';
+	} else { // end of file
+		curChar = '\0';
+	}
+}
+
+// Moves straight to pos, leaving curChar as if nextChar had walked there
+void Lexer::jumpTo(int pos) {
+	curPos = pos - 1;
+	nextChar();
 }
 
 Lexer::Lexer() {
-	source = "\n";
+	source = "";
 	curPos = -1;
 	curChar = '\0';
 	nextChar();
 }
 
-Lexer::Lexer(string input) {
-	source = input + '\n';
+Lexer::Lexer(string_view input) {
+	source = input;
 	curPos = -1;
 	curChar = '\0';
 	nextChar();
 }
 
+// Text from startPos up to and including curChar, as a view into the source
+string_view Lexer::span(int startPos) {
+	if (curPos == (int) source.length()) return string_view("\n", 1);
+	if (curPos > (int) source.length()) return string_view("\0", 1);
+
+	return source.substr(startPos, curPos - startPos + 1);
+}
+
 void Lexer::skipWhitespace() {
-	while (curChar == ' ' || curChar == '\t' || curChar == '\r') nextChar();
+	if (!isBlank(curChar)) return;
+
+	int startPos = curPos + 1;
+	jumpTo(startPos + SCAN.skipBlanks(source.data() + startPos, source.length() - startPos));
 }
 
 void Lexer::skipComment() {
-	if (curChar == '#') {
-		while (curChar != '\n') nextChar();
+	if (curChar == '#') { // runs to the newline, or to the end of the buffer which reads as one
+		jumpTo(curPos + SCAN.findNewline(source.data() + curPos, source.length() - curPos));
 	}
 }
 
 char Lexer::peek() {
-	if (curPos + 1 >= source.length()) {
-		return '\0';
-	} else {
+	if (curPos + 1 < (int) source.length()) {
 		return source[curPos + 1];
+	} else if (curPos + 1 == (int) source.length()) {
+		return '\n';
+	} else {
+		return '\0';
 	}
 }
 
 Token Lexer::getToken() {
 	skipWhitespace();
 	skipComment();
-	Token curToken(string(1,'\0'), TOKEN_TYPE::END);
+	Token curToken(string_view("\0", 1), TOKEN_TYPE::END);
 
 	// get operators
 	if (curChar == '+') {
-		curToken = Token(string(1, curChar), TOKEN_TYPE::PLUS);
+		curToken = Token(span(curPos), TOKEN_TYPE::PLUS);
 	} else if (curChar == '-') {
-		curToken = Token(string(1, curChar), TOKEN_TYPE::MINUS);
+		curToken = Token(span(curPos), TOKEN_TYPE::MINUS);
 	} else if (curChar == '*') {
-		curToken = Token(string(1, curChar), TOKEN_TYPE::ASTERISK);
+		curToken = Token(span(curPos), TOKEN_TYPE::ASTERISK);
 	} else if (curChar == '/') {
-		curToken = Token(string(1, curChar), TOKEN_TYPE::SLASH);
+		curToken = Token(span(curPos), TOKEN_TYPE::SLASH);
 	} else if (curChar == '%') {
-		curToken = Token(string(1, curChar), TOKEN_TYPE::MODULO);
+		curToken = Token(span(curPos), TOKEN_TYPE::MODULO);
 	} else if (curChar == ',') {
-		curToken = Token(string(1, curChar), TOKEN_TYPE::COMMA);
+		curToken = Token(span(curPos), TOKEN_TYPE::COMMA);
+	} else if (curChar == '(') {
+		curToken = Token(span(curPos), TOKEN_TYPE::LPAREN);
+	} else if (curChar == ')') {
+		curToken = Token(span(curPos), TOKEN_TYPE::RPAREN);
 	} else if (curChar == '!') {
 		if (peek() == '=') {
-			char lastChar = curChar;
+			int startPos = curPos;
 			nextChar();
 
-			string concat = string(1,lastChar) = string(1, curChar);
-			curToken = Token(concat, TOKEN_TYPE::NEQ);
+			curToken = Token(span(startPos), TOKEN_TYPE::NEQ);
 		} else {
 			abort("Expected !=, got !" + string(1, peek()));
 		}
 	} else if (curChar == '=') {
 		if (peek() == '=') {
-			char lastChar = curChar;
+			int startPos = curPos;
 			nextChar();
-			string concat =  string(1, lastChar) + string(1, curChar);
-			curToken = Token(concat, TOKEN_TYPE::EQEQ);
+			curToken = Token(span(startPos), TOKEN_TYPE::EQEQ);
 		} else {
-			curToken = Token(string(1, curChar), TOKEN_TYPE::EQ);
+			curToken = Token(span(curPos), TOKEN_TYPE::EQ);
 		}
 	} else if (curChar == '>') {
 		if (peek() == '=') {
-			char lastChar = curChar;
+			int startPos = curPos;
 			nextChar();
 
-			string concat = string(1, lastChar) + string(1, curChar);
-			curToken = Token(concat, TOKEN_TYPE::GTEQ);
+			curToken = Token(span(startPos), TOKEN_TYPE::GTEQ);
 		} else {
-			curToken = Token(string(1, curChar), TOKEN_TYPE::GT);
+			curToken = Token(span(curPos), TOKEN_TYPE::GT);
 		}
 	} else if (curChar == '<') {
 		if (peek() == '=') {
-			char lastChar = curChar;
+			int startPos = curPos;
 			nextChar();
-			string concat = string(1, lastChar) + string(1, curChar);
-			curToken = Token(concat, TOKEN_TYPE::LTEQ);
+			curToken = Token(span(startPos), TOKEN_TYPE::LTEQ);
 		} else {
-			curToken = Token(string(1, curChar), TOKEN_TYPE::LT);
+			curToken = Token(span(curPos), TOKEN_TYPE::LT);
 		}
 	} else if (curChar == '\n') {
-		curToken = Token(string(1, curChar), TOKEN_TYPE::NEWLINE);
+		curToken = Token(span(curPos), TOKEN_TYPE::NEWLINE);
 	} else if (curChar == '\0') {
-		curToken = Token(string(1, curChar), TOKEN_TYPE::END);
+		curToken = Token(span(curPos), TOKEN_TYPE::END);
 	} else if (curChar == '\"') { // detects strings. goes from first quote to next quote and find the substring
 		nextChar();
 		int startPos = curPos;
 
-		while (curChar != '\"') {
-			if (curChar == '\r' || curChar == '\t' || curChar == '\n') {
-				abort("Forbidden character in string");
-			}
-			nextChar();
+		if (curPos < (int) source.length()) {
+			jumpTo(curPos + SCAN.findStringEnd(source.data() + curPos, source.length() - curPos));
+		}
+
+		if (curChar != '\"') { // stopped on \r, \t or \n, or the newline at the end of the buffer
+			abort("Forbidden character in string");
 		}
 
 		curToken.text = source.substr(startPos, curPos - startPos);
@@ -297,14 +423,14 @@ Token Lexer::getToken() {
 			}
 		}
 
-		curToken = Token(source.substr(startPos, curPos - startPos + 1), TOKEN_TYPE::NUMBER);
+		curToken = Token(span(startPos), TOKEN_TYPE::NUMBER);
 	} else if (isalpha(curChar)) { // checks for identifiers and keywords. needs to start with letter and be alphanumeric
 		int startPos = curPos;
 		while (isalnum(peek())) {
 			nextChar();
 		}
 
-		curToken.text = source.substr(startPos, curPos - startPos + 1);
+		curToken.text = span(startPos);
 		TOKEN_TYPE keyword = curToken.checkIfKeyword(curToken.text);
 		if (keyword == INVALID) {
 			curToken.type = TOKEN_TYPE::IDENTIFIER;
@@ -312,7 +438,7 @@ Token Lexer::getToken() {
 			curToken.type = keyword;
 		}
 	} else {
-		abort("Unknown token: " + curToken.text + "\n");
+		abort("Unknown token: " + string(curToken.text) + "\n");
 	}
 
 	nextChar();
@@ -0,0 +1,537 @@
+#include <string>
+#include <vector>
+
+#include "ir.h"
+#include "regalloc.h"
+#include "fold.h"
+#include "trace.h"
+
+#ifndef LOOP_H
+#define LOOP_H
+using namespace std;
+
+// Loop optimizer :
+/*
+	Rewrites WHILE loops in the IR before code generation. First, i * k where
+	i only changes through a single i = i + c at the top level of the body
+	and k doesn't change at all (strength reduction) becomes a new variable,
+	set to i * k before the loop and moved on by c * k right after the
+	i = i + c. Then expressions the loop can't change are worked out once
+	into a new variable before the loop (loop-invariant code motion).
+	Expressions have no side effects and nothing traps (dividing by zero
+	gives 0), so working one out that might not have run at all changes
+	nothing. The new variables are globals at the top level and locals in a
+	function, and only as many are made as there are loop registers left
+	over for them, since one kept in memory costs more than it saves. A loop
+	with a LABEL inside can be entered without passing the code in front of
+	it, so it's left as it is.
+*/
+class LoopOptimizer {
+	public:
+		LoopOptimizer(IrProgram& inputIr);
+		void program();
+		void block(int id, int function);
+		void loop(int id, int function);
+		void scan(int id);
+		void scanExpression(int id);
+		int written(int id);
+		int invariant(int id);
+		int isLeaf(int id);
+		int same(int a, int b);
+		int worth(int id);
+		int operations(int id);
+		int temporary();
+		int leaf(int temp);
+		int assignment(int temp, int value);
+		int copy(int id);
+		void replace(int id, int temp);
+		void reduce(int id);
+		void hoist(int id);
+		void expressions(int id, void (LoopOptimizer::*visit)(int));
+		int induction(int id);
+		int isUpdate(int id);
+
+		IrProgram& ir;
+		RegisterAllocator allocator;	// what a call can write
+		ConstantFolder folder;		// tidies the expressions made here
+
+		// the loop being rewritten
+		int function;			// function it's in, -1 at the top level
+		vector<int> globalWrites;	// assignments in the loop to each global
+		vector<int> localWrites;
+		vector<char> globalUsed;	// INT variables the loop uses, which compete for the loop registers
+		vector<char> localUsed;
+		vector<int> touchedGlobals;	// entries set, so they can be cleared for the next loop
+		vector<int> touchedLocals;
+		vector<int> calls;		// functions called in the loop
+		int labels;			// LABELs in the loop
+		int used;			// distinct INT variables used
+
+		vector<int> updates;		// i = i + c statements of the loop's induction variables
+		vector<int> reduced;		// i * k products already given a variable, and the variable
+		vector<int> reducedTemps;
+		vector<int> hoisted;		// expressions moved in front of the loop, and their variables
+		vector<int> hoistedTemps;
+		vector<int> preheader;		// assignments to put in front of the loop
+
+		int depth;	// loops around the one being rewritten
+		int budget;	// loop registers left for new variables in the outermost loop
+		int temps;	// variables made so far, for their names
+		int hoistCount;
+		int reduceCount;
+};
+
+LoopOptimizer::LoopOptimizer(IrProgram& inputIr) : ir(inputIr), allocator(inputIr), folder(inputIr) {
+	function = -1;
+	labels = 0;
+	used = 0;
+	depth = 0;
+	budget = 0;
+	temps = 0;
+	hoistCount = 0;
+	reduceCount = 0;
+}
+
+void LoopOptimizer::program() {
+	block(ir.main, -1);
+	TRACE(TRACE_STATUS, "loops: " << hoistCount << " expressions hoisted, " << reduceCount << " multiplies strength reduced" << endl);
+}
+
+void LoopOptimizer::block(int id, int inFunction) {
+	for (; id != -1; id = ir.node(id).next) {
+		IrNode& node = ir.node(id);
+
+		switch (node.op) {
+			case IR_IF: {
+				int elseBlock = node.c;
+				block(node.b, inFunction);
+				block(elseBlock, inFunction);
+				break;
+			}
+			case IR_WHILE:
+				loop(id, inFunction);
+				while (ir.node(id).op != IR_WHILE) id = ir.node(id).next; // past what was put in front of it
+				break;
+			case IR_FUNC:
+				block(node.b, node.a);
+				break;
+			default:
+				break;
+		}
+	}
+}
+
+// Records what the statements chained from id assign, call and use
+void LoopOptimizer::scan(int id) {
+	for (; id != -1; id = ir.node(id).next) {
+		IrNode& node = ir.node(id);
+
+		switch (node.op) {
+			case IR_IF:
+				scanExpression(node.a);
+				scan(node.b);
+				scan(node.c);
+				break;
+			case IR_WHILE:
+				scanExpression(node.a);
+				scan(node.b);
+				break;
+			case IR_LABEL:
+				labels++;
+				break;
+			case IR_ASSIGN:
+				scanExpression(node.b);
+				if (globalWrites[node.a]++ == 0) touchedGlobals.push_back(node.a);
+				if (ir.symbolMap.isInt(node.a) && !globalUsed[node.a]++) used++;
+				break;
+			case IR_ASSIGN_LOCAL:
+				scanExpression(node.b);
+				if (localWrites[node.a]++ == 0) touchedLocals.push_back(node.a);
+				if (ir.functionMap.scopes[function].localTypes[node.a] == TOKEN_TYPE::INT && !localUsed[node.a]++) used++;
+				break;
+			case IR_CALL:
+				for (int arg = node.b; arg != -1; arg = ir.node(arg).next) scanExpression(arg);
+				calls.push_back(node.a);
+				break;
+			case IR_PRINT_VALUE:
+				scanExpression(node.a);
+				break;
+			default: // a FUNC's body doesn't run where it's written
+				break;
+		}
+	}
+}
+
+void LoopOptimizer::scanExpression(int id) {
+	IrNode& node = ir.node(id);
+
+	if (node.op == IR_VAR) {
+		if (ir.symbolMap.isInt(node.a) && !globalUsed[node.a]) {
+			globalUsed[node.a] = 1;
+			touchedGlobals.push_back(node.a);
+			used++;
+		}
+	} else if (node.op == IR_LOCAL) {
+		if (ir.functionMap.scopes[function].localTypes[node.a] == TOKEN_TYPE::INT && !localUsed[node.a]) {
+			localUsed[node.a] = 1;
+			touchedLocals.push_back(node.a);
+			used++;
+		}
+	} else if (node.op != IR_NUMBER && node.op != IR_PARAM) {
+		scanExpression(node.a);
+		if (node.b != -1) scanExpression(node.b);
+	}
+}
+
+// 1 when the loop can change the variable a VAR or LOCAL node reads
+int LoopOptimizer::written(int id) {
+	IrNode& node = ir.node(id);
+
+	if (node.op == IR_LOCAL) return localWrites[node.a] != 0; // nothing else can see a local
+	if (globalWrites[node.a] != 0) return 1;
+
+	for (int callee : calls) {
+		if (allocator.writes(callee, node.a)) return 1;
+	}
+	return 0;
+}
+
+// 1 when the expression has the same value on every iteration. Only INT
+// variables and whole numbers, the new variables are INTs
+int LoopOptimizer::invariant(int id) {
+	IrNode& node = ir.node(id);
+
+	switch (node.op) {
+		case IR_NUMBER:
+			return ir.isInteger(id);
+		case IR_PARAM: // parameters are never assigned
+			return 1;
+		case IR_VAR:
+			return ir.symbolMap.isInt(node.a) && !written(id);
+		case IR_LOCAL:
+			return ir.functionMap.scopes[node.b].localTypes[node.a] == TOKEN_TYPE::INT && !written(id);
+		default:
+			if (!invariant(node.a)) return 0;
+			return node.b == -1 || invariant(node.b);
+	}
+}
+
+int LoopOptimizer::isLeaf(int id) {
+	IR_OP op = ir.node(id).op;
+	return op == IR_NUMBER || op == IR_PARAM || op == IR_VAR || op == IR_LOCAL;
+}
+
+// 1 when both expressions are written the same way
+int LoopOptimizer::same(int a, int b) {
+	IrNode& first = ir.node(a);
+	IrNode& second = ir.node(b);
+
+	if (first.op != second.op) return 0;
+	if (first.op == IR_NUMBER) return ir.isInteger(a) && ir.isInteger(b) && first.value == second.value;
+	if (first.op == IR_VAR) return first.a == second.a;
+	if (first.op == IR_PARAM || first.op == IR_LOCAL) return first.a == second.a && first.b == second.b;
+	if (first.op == IR_SHL || first.op == IR_AND) return first.value == second.value && same(first.a, second.a);
+	if (!same(first.a, second.a)) return 0;
+	return first.b == -1 || same(first.b, second.b);
+}
+
+// Operations in the expression, multiplies, divides and loading a parameter counting extra
+int LoopOptimizer::operations(int id) {
+	IrNode& node = ir.node(id);
+	if (node.op == IR_PARAM) return 2; // they're never kept in registers
+	if (isLeaf(id)) return 0;
+
+	int count = (node.op == IR_MUL || node.op == IR_DIV || node.op == IR_MOD) ? 2 : 1;
+	count += operations(node.a);
+	if (node.b != -1) count += operations(node.b);
+	return count;
+}
+
+// Worth a register for the whole loop: more than a single add, shift or and
+// of variables, which already are in registers
+int LoopOptimizer::worth(int id) {
+	return operations(id) >= 2;
+}
+
+// A new INT variable, a global at the top level and a local in a function. -1 when a function has no room for another local
+int LoopOptimizer::temporary() {
+	string name = "@loop" + to_string(temps++); // can't clash with anything written in the source
+
+	if (function == -1) {
+		int symbol = ir.symbolMap.push_back(name, TOKEN_TYPE::INT);
+		globalWrites.push_back(0);
+		globalUsed.push_back(0);
+		return symbol;
+	}
+
+	FunctionScope& scope = ir.functionMap.scopes[function];
+	if (scope.locals.size() >= MAX_LOCALS) return -1;
+
+	int slot = scope.addLocal(name, TOKEN_TYPE::INT);
+	localWrites.push_back(0);
+	localUsed.push_back(0);
+	return slot;
+}
+
+// Node reading temp
+int LoopOptimizer::leaf(int temp) {
+	if (function == -1) return ir.add(IR_VAR, temp);
+	return ir.add(IR_LOCAL, temp, function);
+}
+
+int LoopOptimizer::assignment(int temp, int value) {
+	int id;
+	if (function == -1) id = ir.add(IR_ASSIGN, temp, value);
+	else id = ir.add(IR_ASSIGN_LOCAL, temp, value, function);
+
+	if (function == -1) {
+		if (globalWrites[temp]++ == 0) touchedGlobals.push_back(temp);
+	} else if (localWrites[temp]++ == 0) {
+		touchedLocals.push_back(temp);
+	}
+	return id;
+}
+
+// Copy of the expression, so it can be used somewhere else as well
+int LoopOptimizer::copy(int id) {
+	IrNode node = ir.node(id);
+	node.next = -1;
+
+	if (!isLeaf(id)) {
+		node.a = copy(node.a);
+		if (node.b != -1) node.b = copy(node.b);
+	}
+
+	ir.nodes.push_back(node);
+	return ir.nodes.size() - 1;
+}
+
+// Makes node id read temp instead, keeping its place in any argument chain
+void LoopOptimizer::replace(int id, int temp) {
+	int with = leaf(temp);
+	int next = ir.node(id).next;
+	ir.nodes[id] = ir.nodes[with];
+	ir.nodes[id].next = next;
+}
+
+// Index into updates of the i = i + c that i, a VAR or LOCAL node, only changes through, -1 if it isn't an induction variable
+int LoopOptimizer::induction(int id) {
+	IrNode& node = ir.node(id);
+	if (node.op != IR_VAR && node.op != IR_LOCAL) return -1;
+
+	for (int i = 0; i < (int) updates.size(); i++) {
+		IrNode& update = ir.node(updates[i]);
+		if ((update.op == IR_ASSIGN) == (node.op == IR_VAR) && update.a == node.a) return i;
+	}
+	return -1;
+}
+
+// 1 for a statement i = i + c or i = i - c on an INT i the loop changes nowhere else
+int LoopOptimizer::isUpdate(int id) {
+	IrNode& node = ir.node(id);
+	if (node.op != IR_ASSIGN && node.op != IR_ASSIGN_LOCAL) return 0;
+
+	IrNode& value = ir.node(node.b);
+	if ((value.op != IR_ADD && value.op != IR_SUB) || !ir.isInteger(value.b)) return 0;
+
+	IrNode& variable = ir.node(value.a);
+	if (variable.op != (node.op == IR_ASSIGN ? IR_VAR : IR_LOCAL) || variable.a != node.a) return 0;
+
+	if (node.op == IR_ASSIGN_LOCAL) {
+		return localWrites[node.a] == 1 && ir.functionMap.scopes[function].localTypes[node.a] == TOKEN_TYPE::INT;
+	}
+
+	if (globalWrites[node.a] != 1 || !ir.symbolMap.isInt(node.a)) return 0;
+	for (int callee : calls) {
+		if (allocator.writes(callee, node.a)) return 0;
+	}
+	return 1;
+}
+
+// Strength reduction of an i * k inside the expression
+void LoopOptimizer::reduce(int id) {
+	if (isLeaf(id)) return;
+
+	reduce(ir.node(id).a);
+	if (ir.node(id).b != -1) reduce(ir.node(id).b);
+	if (ir.node(id).op != IR_MUL) return;
+
+	int variable = ir.node(id).a;
+	int factor = ir.node(id).b;
+	if (induction(variable) == -1) swap(variable, factor);
+
+	int update = induction(variable);
+	if (update == -1 || !isLeaf(factor) || !invariant(factor)) return;
+
+	int temp = -1;
+	for (int i = 0; i < (int) reduced.size() && temp == -1; i++) {
+		if (same(reduced[i], id)) temp = reducedTemps[i];
+	}
+
+	if (temp == -1) {
+		if (budget == 0) return;
+		temp = temporary();
+		if (temp == -1) return;
+		budget--;
+
+		reduced.push_back(copy(id));
+		reducedTemps.push_back(temp);
+		preheader.push_back(assignment(temp, copy(id)));
+
+		// right after i = i + c comes temp = temp + k * c, with a
+		// constant k worked out here and anything else left to hoisting
+		IrNode& step = ir.node(ir.node(updates[update]).b);
+		unsigned long long c = ir.node(step.b).value;
+		if (step.op == IR_SUB) c = 0 - c;
+
+		int increment;
+		if (ir.isInteger(factor)) {
+			increment = ir.add(IR_NUMBER);
+			ir.node(increment).value = (long long) (c * (unsigned long long) ir.node(factor).value);
+		} else {
+			int times = ir.add(IR_NUMBER);
+			ir.node(times).value = (long long) c;
+			increment = ir.add(IR_MUL, copy(factor), times);
+			folder.expression(increment); // a shift, or just k
+		}
+
+		int moved = assignment(temp, ir.add(IR_ADD, leaf(temp), increment));
+		ir.node(moved).next = ir.node(updates[update]).next;
+		ir.node(updates[update]).next = moved;
+		reduceCount++;
+	}
+
+	replace(id, temp);
+}
+
+// Moves the largest parts of the expression that don't change in the loop in front of it
+void LoopOptimizer::hoist(int id) {
+	if (isLeaf(id) && ir.node(id).op != IR_PARAM) return;
+
+	if (!invariant(id) || !worth(id)) {
+		hoist(ir.node(id).a);
+		if (ir.node(id).b != -1) hoist(ir.node(id).b);
+		return;
+	}
+
+	int temp = -1;
+	for (int i = 0; i < (int) hoisted.size() && temp == -1; i++) {
+		if (same(hoisted[i], id)) temp = hoistedTemps[i];
+	}
+
+	if (temp == -1) {
+		if (budget == 0) return;
+		temp = temporary();
+		if (temp == -1) return;
+		budget--;
+
+		int value = copy(id);
+		hoisted.push_back(value);
+		hoistedTemps.push_back(temp);
+		preheader.push_back(assignment(temp, value));
+		hoistCount++;
+	}
+
+	replace(id, temp);
+}
+
+// Calls visit on every expression in the statements chained from id
+void LoopOptimizer::expressions(int id, void (LoopOptimizer::*visit)(int)) {
+	for (; id != -1; id = ir.node(id).next) {
+		IrNode node = ir.node(id); // a copy, visit adds nodes
+
+		switch (node.op) {
+			case IR_IF:
+				(this->*visit)(ir.node(node.a).a); // conditions compare two expressions
+				(this->*visit)(ir.node(node.a).b);
+				expressions(node.b, visit);
+				expressions(node.c, visit);
+				break;
+			case IR_WHILE:
+				(this->*visit)(ir.node(node.a).a);
+				(this->*visit)(ir.node(node.a).b);
+				expressions(node.b, visit);
+				break;
+			case IR_ASSIGN:
+			case IR_ASSIGN_LOCAL:
+				(this->*visit)(node.b);
+				break;
+			case IR_CALL:
+				for (int arg = node.b; arg != -1; arg = ir.node(arg).next) (this->*visit)(arg);
+				break;
+			case IR_PRINT_VALUE:
+				(this->*visit)(node.a);
+				break;
+			default:
+				break;
+		}
+	}
+}
+
+// Rewrites the WHILE at id, which stays first in its chain: anything put
+// in front of the loop goes into id, and the loop moves to a new node
+void LoopOptimizer::loop(int id, int inFunction) {
+	function = inFunction;
+	globalWrites.resize(ir.symbolMap.size(), 0);
+	globalUsed.resize(ir.symbolMap.size(), 0);
+	int locals = (function == -1) ? 0 : ir.functionMap.scopes[function].locals.size();
+	localWrites.assign(locals, 0);
+	localUsed.assign(locals, 0);
+
+	labels = 0;
+	used = 0;
+	calls.clear();
+	scanExpression(ir.node(id).a);
+	scan(ir.node(id).b);
+
+	if (depth == 0) budget = max(SAVED_REGISTERS - used, 0);
+
+	updates.clear();
+	reduced.clear();
+	reducedTemps.clear();
+	hoisted.clear();
+	hoistedTemps.clear();
+	preheader.clear();
+
+	if (labels == 0) {
+		for (int statement = ir.node(id).b; statement != -1; statement = ir.node(statement).next) {
+			if (isUpdate(statement)) updates.push_back(statement);
+		}
+
+		reduce(ir.node(ir.node(id).a).a);
+		reduce(ir.node(ir.node(id).a).b);
+		expressions(ir.node(id).b, &LoopOptimizer::reduce);
+
+		hoist(ir.node(ir.node(id).a).a);
+		hoist(ir.node(ir.node(id).a).b);
+		expressions(ir.node(id).b, &LoopOptimizer::hoist);
+	}
+
+	for (int symbol : touchedGlobals) {
+		globalWrites[symbol] = 0;
+		globalUsed[symbol] = 0;
+	}
+	touchedGlobals.clear();
+	touchedLocals.clear();
+
+	int body = ir.node(id).b;
+
+	if (!preheader.empty()) {
+		IrNode whileNode = ir.node(id);
+		ir.nodes.push_back(whileNode);
+		int moved = ir.nodes.size() - 1;
+
+		for (int i = 0; i + 1 < (int) preheader.size(); i++) ir.node(preheader[i]).next = preheader[i + 1];
+		ir.node(preheader.back()).next = moved;
+
+		ir.nodes[id] = ir.nodes[preheader[0]];
+		id = moved;
+	}
+
+	depth++;
+	block(body, inFunction);
+	depth--;
+	function = inFunction;
+}
+
+#endif
@@ -1,58 +1,95 @@
 #include <iostream>
-#include <fstream>
 #include <string>
-#include <sstream>
+#include <vector>
 #include <regex>
 
 #include "lexer.h"
 #include "parser.h"
+#include "fold.h"
+#include "dce.h"
+#include "loop.h"
+#include "codegen.h"
+#include "trace.h"
 
 using namespace std;
 
-int main(int argc, char* argv[]) { // compiler <fileName> -o <outputName>
-	cout << "<----- Simple Compiler ----->" << endl;
-	if (argc < 2) {
+int main(int argc, char* argv[]) { // compiler [-v | --trace] [--stream] [-c | --exe] <fileName> <outputName>
+	vector<string> files;
+	int stream = 0;
+	int object = 0;
+	int executable = 0;
+
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+
+		if (arg == "-v") {
+			traceLevel = max(traceLevel, (int) TRACE_STATUS);
+		} else if (arg == "--trace") {
+			traceLevel = TRACE_PARSER;
+		} else if (arg == "--stream") { // write the assembly as it's generated, so the output buffers stay small
+			stream = 1;
+		} else if (arg == "-c") { // write an ELF object file instead of assembly
+			object = 1;
+		} else if (arg == "--exe") { // write a static executable, linked without going through as and ld
+			executable = 1;
+		} else {
+			files.push_back(arg);
+		}
+	}
+
+	TRACE(TRACE_STATUS, "<----- Simple Compiler ----->" << endl);
+	if (files.size() < 1) {
 		cerr << "Error: you need to input a file to compile\n";
-		cerr << "./compiler <filename>" << endl;
+		cerr << "./compiler [-v | --trace] [--stream] [-c | --exe] <filename>" << endl;
 		return 1;
 	}
 
-	string filename = argv[1];
-	ifstream sourceFile(filename);
+	string filename = files[0];
+	SourceFile sourceFile;
 
-	if (!sourceFile.is_open()) {
+	if (!sourceFile.open(filename)) {
 		cerr << "Error unable to open file: " << filename << endl;
 		return 1;
 	}
 
-	regex pattern(R"(.*\.(s)$)");
+	regex pattern(executable ? R"(.*[^/])" : object ? R"(.*\.(o)$)" : R"(.*\.(s)$)"); // an executable can be called anything
 
-	string outFilePath = "out.s";
+	string outFilePath = executable ? "a.out" : object ? "out.o" : "out.s";
 	cmatch cm;
 
-	if (argc >= 3) {
-		if (regex_match(argv[2], cm, pattern)) {
-			outFilePath = argv[2];
+	if (files.size() >= 2) {
+		if (regex_match(files[1].c_str(), cm, pattern)) {
+			outFilePath = files[1];
 		} else {
-			cout << argv[2] << " is not a valid file name. Outputting to /out.s" << endl;
+			cerr << files[1] << " is not a valid file name. Outputting to /" << outFilePath << endl;
 		}
 	}
 
 
-	ostringstream ss;
-	ss << sourceFile.rdbuf();
-	string source = ss.str();
-
-	Lexer lexer(source);
+	Lexer lexer(sourceFile.view());
 	Emitter emitter(outFilePath);
+	if (executable) emitter.executableMode();
+	else if (object) emitter.objectMode(); // the object is built in memory, --stream only applies to assembly
+	else if (stream) emitter.startStreaming();
 
-	Parser parser(lexer, emitter);
-
+	IrProgram ir;
+	Parser parser(lexer, ir);
 	parser.program();
+
+	ConstantFolder folder(ir);
+	folder.program();
+
+	DeadCodeEliminator eliminator(ir);
+	eliminator.program();
+
+	LoopOptimizer loops(ir);
+	loops.program();
+
+	CodeGenerator generator(ir, emitter);
+	generator.program();
 	emitter.writeFile();
-	cout << "Compilation successful." << endl;
+	TRACE(TRACE_STATUS, "Compilation successful." << endl);
 
-	sourceFile.close();
 	return 0;
 }
 
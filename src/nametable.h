@@ -0,0 +1,92 @@
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifndef NAMETABLE_H
+#define NAMETABLE_H
+using namespace std;
+
+// Interned name table :
+/*
+	Gives every distinct name a stable integer id, in the order the names were
+	first added, so ids can be used directly for labels (V0, S3, FUNC1, ...).
+	Lookups go through an open addressing hash table with linear probing, which
+	holds id + 1 in each slot (0 is empty) and is kept at most half full.
+*/
+class NameTable {
+	public:
+		NameTable();
+		int find(string_view name) const;
+		int insert(string_view name);
+		int size() const;
+		static unsigned hash(string_view name);
+		void grow();
+
+		vector<string> names;		// indexed by id
+		vector<unsigned> hashes;	// hash of each name, so growing doesn't rehash the text
+		vector<int> slots;
+};
+
+NameTable::NameTable() {
+	slots.assign(16, 0);
+}
+
+// FNV-1a
+unsigned NameTable::hash(string_view name) {
+	unsigned h = 2166136261u;
+	for (char c : name) {
+		h ^= (unsigned char) c;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+// Returns the id of name, or -1 when it hasn't been added
+int NameTable::find(string_view name) const {
+	unsigned h = hash(name);
+	unsigned mask = slots.size() - 1;
+
+	for (unsigned i = h & mask; slots[i] != 0; i = (i + 1) & mask) {
+		int id = slots[i] - 1;
+		if (hashes[id] == h && names[id] == name) return id;
+	}
+	return -1;
+}
+
+// Returns the id of name, adding it first if it's new
+int NameTable::insert(string_view name) {
+	unsigned h = hash(name);
+	unsigned mask = slots.size() - 1;
+
+	unsigned i = h & mask;
+	for (; slots[i] != 0; i = (i + 1) & mask) {
+		int id = slots[i] - 1;
+		if (hashes[id] == h && names[id] == name) return id;
+	}
+
+	int id = names.size();
+	names.emplace_back(name);
+	hashes.push_back(h);
+	slots[i] = id + 1;
+
+	if (names.size() * 2 > slots.size()) grow();
+	return id;
+}
+
+int NameTable::size() const {
+	return names.size();
+}
+
+// Doubles the slot array and puts every id back in its new place
+void NameTable::grow() {
+	slots.assign(slots.size() * 2, 0);
+	unsigned mask = slots.size() - 1;
+
+	for (int id = 0; id < (int) names.size(); id++) {
+		unsigned i = hashes[id] & mask;
+		while (slots[i] != 0) i = (i + 1) & mask;
+		slots[i] = id + 1;
+	}
+}
+
+#endif
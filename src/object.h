@@ -0,0 +1,552 @@
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstring>
+#include <cctype>
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "instr.h"
+#include "encoder.h"
+#include "nametable.h"
+#include "outbuf.h"
+
+#ifndef OBJECT_H
+#define OBJECT_H
+using namespace std;
+
+enum OBJECT_SECTION : unsigned char {
+	SECTION_NONE,	// not defined yet
+	SECTION_TEXT,
+	SECTION_DATA,
+	SECTION_BSS,
+	SECTION_ABSOLUTE	// a number, like the length of a string
+};
+
+enum TEXT_PART : unsigned char {
+	PART_CODE,	// the main code, _start first
+	PART_FUNCTIONS	// functions and the runtime, after the code
+};
+
+struct ObjectSymbol {
+	OBJECT_SECTION section;
+	TEXT_PART part;	// for SECTION_TEXT
+	int global;
+	unsigned long long value;	// offset into the section, or into the part for text
+};
+
+struct Fixup {	// a label's address or value that's put in once every label is known
+	TEXT_PART part;
+	OPCODE op;	// the instruction at offset, or OP_LTORG for an 8 byte literal pool slot holding the label
+	int label;
+	size_t offset;
+};
+
+struct Literal {	// a value waiting for the next literal pool
+	int label;	// -1 for a number
+	long long imm;
+	vector<size_t> loads;	// offsets of the ldr instructions that read it
+};
+
+// Object file :
+/*
+	An ELF64 relocatable object for AArch64, built straight from the
+	instruction lists by -c so no assembler is needed. The text section is
+	made of two parts that grow separately, the main code and the functions,
+	the same way the emitter keeps them as two sections of text, and the
+	functions are put after the code once it's done. Instructions are encoded
+	as they come, and anything that refers to a label is recorded as a fixup.
+	At the end, branches and adr within the text are resolved to their
+	displacement, the way an assembler resolves local labels in the same
+	section, and only adr of something in .data or .bss becomes a relocation
+	(R_AARCH64_ADR_PREL_LO21) for the linker. ldr = constants collect in a
+	literal pool placed at each .ltorg, or at the end of the part, with
+	duplicates shared.
+*/
+class ObjectFile {
+	public:
+		ObjectFile();
+		void instructions(const vector<Instr>& instrs, TEXT_PART part);
+		void literal(const Instr& instr, TEXT_PART part, size_t offset);
+		void literalPool(TEXT_PART part);
+		void word(vector<unsigned char>& bytes, unsigned value);
+		void quadWord(vector<unsigned char>& bytes, unsigned long long value);
+		void align(vector<unsigned char>& bytes, size_t alignment);
+		void define(int label, OBJECT_SECTION section, unsigned long long value, TEXT_PART part = PART_CODE);
+		void mapping(TEXT_PART part, char kind);
+		void quad(int label);
+		void ascii(int label, string_view text, int terminated);
+		void length(int label, int of);
+		void reserve(int label, size_t bytes, size_t alignment);
+		void global(int label);
+		static string unescape(string_view text);
+		unsigned long long address(int label);
+		void link();
+		void relocate(const unsigned long long base[]);
+		void write(string path, int executable);
+		void abort(string message);
+
+		NameTable* labels;	// the code generator's, label ids index symbols
+		vector<unsigned char> text[2];	// by TEXT_PART
+		vector<unsigned char> data;
+		size_t bssSize;
+		size_t bssAlignment;
+		size_t functionsStart;	// where the functions part begins in .text, set by link()
+
+		vector<ObjectSymbol> symbols;	// by label id
+		vector<Fixup> fixups;
+		vector<Literal> pending[2];	// literals for the next pool of each part
+		map<pair<int, long long>, int> pendingIndex[2];	// (label, imm) -> index into pending
+		vector<pair<size_t, char>> mappings[2];	// $x and $d mapping symbols: offset in the part, 'x' for code or 'd' for data
+		vector<Elf64_Rela> relocations;
+
+		static const unsigned long long LOAD_ADDRESS = 0x400000;	// where an executable's first segment goes, as ld puts it
+		static const unsigned long long SEGMENT_ALIGNMENT = 0x10000;	// segment alignment, the largest page size AArch64 Linux uses
+};
+
+ObjectFile::ObjectFile() {
+	labels = nullptr;
+	bssSize = 0;
+	bssAlignment = 1;
+	functionsStart = 0;
+}
+
+void ObjectFile::abort(string message) {
+	cerr << "Error (OBJECT)\n";
+	cerr << message << endl;
+	exit(1);
+}
+
+void ObjectFile::word(vector<unsigned char>& bytes, unsigned value) { // little endian
+	for (int i = 0; i < 4; i++) bytes.push_back((value >> (8 * i)) & 0xff);
+}
+
+void ObjectFile::quadWord(vector<unsigned char>& bytes, unsigned long long value) {
+	for (int i = 0; i < 8; i++) bytes.push_back((value >> (8 * i)) & 0xff);
+}
+
+void ObjectFile::align(vector<unsigned char>& bytes, size_t alignment) {
+	while (bytes.size() % alignment != 0) bytes.push_back(0);
+}
+
+void ObjectFile::define(int label, OBJECT_SECTION section, unsigned long long value, TEXT_PART part) {
+	if ((int) symbols.size() <= label) symbols.resize(label + 1, {SECTION_NONE, PART_CODE, 0, 0});
+
+	if (symbols[label].section != SECTION_NONE) {
+		abort("Label defined twice: " + labels->names[label]);
+	}
+	symbols[label].section = section;
+	symbols[label].part = part;
+	symbols[label].value = value;
+}
+
+// Switches the part between code and data, as the disassembler needs to know
+void ObjectFile::mapping(TEXT_PART part, char kind) {
+	vector<pair<size_t, char>>& marks = mappings[part];
+	if (!marks.empty() && marks.back().second == kind) return;
+
+	if (!marks.empty() && marks.back().first == text[part].size()) marks.back().second = kind; // nothing was in the other kind
+	else marks.push_back({text[part].size(), kind});
+}
+
+// Encodes a list that's been through the optimizers onto the end of its part
+void ObjectFile::instructions(const vector<Instr>& instrs, TEXT_PART part) {
+	vector<unsigned char>& bytes = text[part];
+	if (!instrs.empty()) mapping(part, 'x');
+
+	for (const Instr& instr : instrs) {
+		if (instr.op == OP_NOP) continue;
+
+		if (instr.op == OP_LABEL) {
+			define(instr.label, SECTION_TEXT, bytes.size(), part);
+			continue;
+		}
+
+		if (instr.op == OP_LTORG) {
+			literalPool(part);
+			continue;
+		}
+
+		unsigned value;
+		if (!encodeInstr(instr, value)) {
+			string line;
+			InstrList list(*labels);
+			list.renderInstr(instr, line);
+			abort("Cannot encode instruction: " + line);
+		}
+
+		if (instr.op == OP_LDR_LITERAL) literal(instr, part, bytes.size());
+		else if (hasDisplacement(instr.op)) fixups.push_back({part, instr.op, instr.label, bytes.size()});
+
+		word(bytes, value);
+	}
+}
+
+// Adds the constant an ldr = loads to the next pool
+void ObjectFile::literal(const Instr& instr, TEXT_PART part, size_t offset) {
+	pair<int, long long> key = {instr.label, instr.label == -1 ? instr.imm : 0};
+
+	auto found = pendingIndex[part].find(key);
+	if (found == pendingIndex[part].end()) {
+		found = pendingIndex[part].insert({key, (int) pending[part].size()}).first;
+		pending[part].push_back({key.first, key.second, {}});
+	}
+	pending[part][found->second].loads.push_back(offset);
+}
+
+// Places the waiting literals, 8 byte aligned, and points their loads at them
+void ObjectFile::literalPool(TEXT_PART part) {
+	if (pending[part].empty()) return;
+
+	vector<unsigned char>& bytes = text[part];
+	align(bytes, 8);
+	mapping(part, 'd');
+
+	for (Literal& literal : pending[part]) {
+		size_t slot = bytes.size();
+
+		if (literal.label == -1) quadWord(bytes, literal.imm);
+		else {
+			fixups.push_back({part, OP_LTORG, literal.label, slot});
+			quadWord(bytes, 0);
+		}
+
+		for (size_t load : literal.loads) {
+			unsigned value;
+			memcpy(&value, &bytes[load], 4);
+			if (!setDisplacement(value, OP_LDR_LITERAL, (long long) slot - (long long) load)) {
+				abort("Literal pool out of range of ldr");
+			}
+			memcpy(&bytes[load], &value, 4);
+		}
+	}
+
+	pending[part].clear();
+	pendingIndex[part].clear();
+	mapping(part, 'x');
+}
+
+// label: .quad 0
+void ObjectFile::quad(int label) {
+	define(label, SECTION_DATA, data.size());
+	quadWord(data, 0);
+}
+
+// label: .asciz "text", or .ascii, with the escapes the assembler would take
+void ObjectFile::ascii(int label, string_view text, int terminated) {
+	define(label, SECTION_DATA, data.size());
+
+	string bytes = unescape(text);
+	data.insert(data.end(), bytes.begin(), bytes.end());
+	if (terminated) data.push_back(0);
+}
+
+// label = . - of
+void ObjectFile::length(int label, int of) {
+	if (of >= (int) symbols.size() || symbols[of].section != SECTION_DATA) {
+		abort("Length of a label that isn't data: " + labels->names[of]);
+	}
+	define(label, SECTION_ABSOLUTE, data.size() - symbols[of].value);
+}
+
+// label: .skip bytes in .bss
+void ObjectFile::reserve(int label, size_t bytes, size_t alignment) {
+	bssSize = (bssSize + alignment - 1) / alignment * alignment;
+	bssAlignment = max(bssAlignment, alignment);
+
+	define(label, SECTION_BSS, bssSize);
+	bssSize += bytes;
+}
+
+void ObjectFile::global(int label) {
+	if ((int) symbols.size() <= label) symbols.resize(label + 1, {SECTION_NONE, PART_CODE, 0, 0});
+	symbols[label].global = 1;
+}
+
+// The bytes of a string literal, decoding \n, \t, \", \\, octal and \x escapes like GNU as
+string ObjectFile::unescape(string_view text) {
+	string bytes;
+
+	for (size_t i = 0; i < text.length(); i++) {
+		if (text[i] != '\\' || i + 1 == text.length()) {
+			bytes += text[i];
+			continue;
+		}
+
+		char c = text[++i];
+		switch (c) {
+			case 'n': bytes += '\n'; break;
+			case 't': bytes += '\t'; break;
+			case 'r': bytes += '\r'; break;
+			case 'b': bytes += '\b'; break;
+			case 'f': bytes += '\f'; break;
+			case 'x': {
+				int value = 0;
+				while (i + 1 < text.length() && isxdigit((unsigned char) text[i + 1])) {
+					char digit = text[++i];
+					value = value * 16 + (isdigit((unsigned char) digit) ? digit - '0' : (tolower(digit) - 'a' + 10));
+				}
+				bytes += (char) value;
+				break;
+			}
+			default:
+				if (c >= '0' && c <= '7') {
+					int value = c - '0';
+					for (int digits = 1; digits < 3 && i + 1 < text.length() && text[i + 1] >= '0' && text[i + 1] <= '7'; digits++) {
+						value = value * 8 + (text[++i] - '0');
+					}
+					bytes += (char) value;
+				} else bytes += c; // \" and \\, and anything else stands for itself
+				break;
+		}
+	}
+	return bytes;
+}
+
+// Offset of a label in its section, with the functions part moved after the code
+unsigned long long ObjectFile::address(int label) {
+	if (label >= (int) symbols.size() || symbols[label].section == SECTION_NONE) {
+		abort("Undefined label: " + labels->names[label]);
+	}
+
+	const ObjectSymbol& symbol = symbols[label];
+	if (symbol.section == SECTION_TEXT && symbol.part == PART_FUNCTIONS) return functionsStart + symbol.value;
+	return symbol.value;
+}
+
+// Joins the two parts into .text and resolves every fixup, as displacements or relocations
+void ObjectFile::link() {
+	literalPool(PART_CODE);
+	literalPool(PART_FUNCTIONS);
+
+	vector<unsigned char>& bytes = text[PART_CODE];
+	while (bytes.size() % 8 != 0) word(bytes, 0xd503201f); // nop, so the functions' literal pools stay aligned
+	functionsStart = bytes.size();
+
+	for (auto& mark : mappings[PART_FUNCTIONS]) mappings[PART_CODE].push_back({mark.first + functionsStart, mark.second});
+	bytes.insert(bytes.end(), text[PART_FUNCTIONS].begin(), text[PART_FUNCTIONS].end());
+	text[PART_FUNCTIONS].clear();
+
+	for (const Fixup& fixup : fixups) {
+		size_t place = fixup.offset + (fixup.part == PART_FUNCTIONS ? functionsStart : 0);
+		const ObjectSymbol& target = symbols[fixup.label];
+		unsigned long long value = address(fixup.label);
+
+		if (fixup.op == OP_LTORG) { // a pool slot, absolute values are put straight in
+			if (target.section == SECTION_ABSOLUTE) {
+				for (int i = 0; i < 8; i++) bytes[place + i] = (value >> (8 * i)) & 0xff;
+			} else {
+				relocations.push_back({place, ELF64_R_INFO(target.section, R_AARCH64_ABS64), (Elf64_Sxword) value});
+			}
+			continue;
+		}
+
+		if (target.section != SECTION_TEXT) {
+			if (fixup.op != OP_ADR || target.section == SECTION_ABSOLUTE) {
+				abort("Branch to a label that isn't code: " + labels->names[fixup.label]);
+			}
+			relocations.push_back({place, ELF64_R_INFO(target.section, R_AARCH64_ADR_PREL_LO21), (Elf64_Sxword) value});
+			continue;
+		}
+
+		unsigned instruction;
+		memcpy(&instruction, &bytes[place], 4);
+		if (!setDisplacement(instruction, fixup.op, (long long) value - (long long) place)) {
+			abort("Label out of range of its branch: " + labels->names[fixup.label]);
+		}
+		memcpy(&bytes[place], &instruction, 4);
+	}
+
+	sort(relocations.begin(), relocations.end(), [](const Elf64_Rela& a, const Elf64_Rela& b) { return a.r_offset < b.r_offset; });
+}
+
+// Puts the final addresses in every relocation for an executable, with sections at base (by OBJECT_SECTION)
+void ObjectFile::relocate(const unsigned long long base[]) {
+	vector<unsigned char>& bytes = text[PART_CODE];
+
+	for (const Elf64_Rela& relocation : relocations) {
+		unsigned long long target = base[ELF64_R_SYM(relocation.r_info)] + relocation.r_addend;
+		unsigned long long place = base[SECTION_TEXT] + relocation.r_offset;
+
+		if (ELF64_R_TYPE(relocation.r_info) == R_AARCH64_ABS64) {
+			for (int i = 0; i < 8; i++) bytes[relocation.r_offset + i] = (target >> (8 * i)) & 0xff;
+			continue;
+		}
+
+		unsigned instruction;
+		memcpy(&instruction, &bytes[relocation.r_offset], 4);
+		if (!setDisplacement(instruction, OP_ADR, (long long) (target - place))) {
+			abort("Data out of range of adr, the code is over 1MB");
+		}
+		memcpy(&bytes[relocation.r_offset], &instruction, 4);
+	}
+	relocations.clear();
+}
+
+// Writes the ELF file: header, .text, .data, .symtab, .strtab, .shstrtab and .rela.text, then the section headers.
+// An executable has program headers after the ELF header and everything at its final address instead of relocations
+void ObjectFile::write(string path, int executable) {
+	link();
+
+	// Sections in header order, the first three section symbols share their index
+	enum { SH_NULL, SH_TEXT, SH_DATA, SH_BSS, SH_SYMTAB, SH_STRTAB, SH_SHSTRTAB, SH_RELA, SH_COUNT };
+	static const char* const names[SH_COUNT] = {"", ".text", ".data", ".bss", ".symtab", ".strtab", ".shstrtab", ".rela.text"};
+	int sectionCount = executable ? SH_RELA : SH_COUNT;
+
+	string sectionNames;
+	Elf64_Word nameOffsets[SH_COUNT];
+	for (int i = 0; i < sectionCount; i++) {
+		nameOffsets[i] = sectionNames.size();
+		sectionNames += names[i];
+		sectionNames += '\0';
+	}
+
+	// Layout. The executable is loaded as two segments: the headers with .text, then .data with .bss after it
+	vector<unsigned char>& code = text[PART_CODE];
+	auto alignUp = [](size_t offset, size_t alignment) { return (offset + alignment - 1) / alignment * alignment; };
+
+	int segmentCount = (executable && data.size() + bssSize > 0) ? 2 : executable;
+	size_t offset = sizeof(Elf64_Ehdr) + segmentCount * sizeof(Elf64_Phdr);
+	unsigned long long base[] = {0, 0, 0, 0, 0}; // address of each OBJECT_SECTION
+
+	Elf64_Shdr headers[SH_COUNT];
+	memset(headers, 0, sizeof(headers));
+
+	auto place = [&](int index, Elf64_Word type, Elf64_Xword flags, size_t size, size_t alignment, size_t entrySize) {
+		if (type != SHT_NOBITS) offset = alignUp(offset, alignment); // .bss takes no room in the file
+		headers[index] = {nameOffsets[index], type, flags, 0, offset, size, 0, 0, alignment, entrySize};
+		if (type != SHT_NOBITS) offset += size;
+	};
+
+	place(SH_TEXT, SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, code.size(), 8, 0);
+	place(SH_DATA, SHT_PROGBITS, SHF_ALLOC | SHF_WRITE, data.size(), 8, 0);
+	place(SH_BSS, SHT_NOBITS, SHF_ALLOC | SHF_WRITE, bssSize, bssAlignment, 0);
+
+	if (executable) { // the data segment starts on a new page, at the same offset into the page as in the file
+		base[SECTION_TEXT] = LOAD_ADDRESS + headers[SH_TEXT].sh_offset;
+		base[SECTION_DATA] = alignUp(base[SECTION_TEXT] + code.size(), SEGMENT_ALIGNMENT) + headers[SH_DATA].sh_offset % SEGMENT_ALIGNMENT;
+		base[SECTION_BSS] = alignUp(base[SECTION_DATA] + data.size(), bssAlignment);
+
+		for (int section = SH_TEXT; section <= SH_BSS; section++) headers[section].sh_addr = base[section];
+		relocate(base);
+	}
+
+	// Symbols: locals first, the null symbol and the sections, then labels and mapping symbols, then globals
+	vector<Elf64_Sym> symbolTable;
+	string strings(1, '\0');
+
+	symbolTable.push_back({0, 0, 0, 0, 0, 0});
+	for (int section = SH_TEXT; section <= SH_BSS; section++) {
+		symbolTable.push_back({0, ELF64_ST_INFO(STB_LOCAL, STT_SECTION), 0, (Elf64_Section) section, base[section], 0});
+	}
+
+	auto addSymbol = [&](string_view name, int binding, Elf64_Section section, unsigned long long value) {
+		symbolTable.push_back({(Elf64_Word) strings.size(), (unsigned char) ELF64_ST_INFO(binding, STT_NOTYPE), 0, section, value, 0});
+		strings += name;
+		strings += '\0';
+	};
+
+	static const Elf64_Section sectionIndexes[] = {SHN_UNDEF, SH_TEXT, SH_DATA, SH_BSS, SHN_ABS};
+
+	for (auto& mark : mappings[PART_CODE]) addSymbol(mark.second == 'x' ? "$x" : "$d", STB_LOCAL, SH_TEXT, base[SECTION_TEXT] + mark.first);
+	for (int binding : {STB_LOCAL, STB_GLOBAL}) {
+		for (int label = 0; label < (int) symbols.size(); label++) {
+			const ObjectSymbol& symbol = symbols[label];
+			if (symbol.section == SECTION_NONE || (symbol.global == 1) != (binding == STB_GLOBAL)) continue;
+			addSymbol(labels->names[label], binding, sectionIndexes[symbol.section], base[symbol.section] + address(label));
+		}
+	}
+
+	Elf64_Word firstGlobal = symbolTable.size();
+	for (Elf64_Word i = 0; i < symbolTable.size(); i++) {
+		if (ELF64_ST_BIND(symbolTable[i].st_info) == STB_GLOBAL) {
+			firstGlobal = i;
+			break;
+		}
+	}
+
+	place(SH_SYMTAB, SHT_SYMTAB, 0, symbolTable.size() * sizeof(Elf64_Sym), 8, sizeof(Elf64_Sym));
+	place(SH_STRTAB, SHT_STRTAB, 0, strings.size(), 1, 0);
+	place(SH_SHSTRTAB, SHT_STRTAB, 0, sectionNames.size(), 1, 0);
+	if (!executable) place(SH_RELA, SHT_RELA, SHF_INFO_LINK, relocations.size() * sizeof(Elf64_Rela), 8, sizeof(Elf64_Rela));
+
+	headers[SH_SYMTAB].sh_link = SH_STRTAB;
+	headers[SH_SYMTAB].sh_info = firstGlobal;
+	headers[SH_RELA].sh_link = SH_SYMTAB;
+	headers[SH_RELA].sh_info = SH_TEXT;
+
+	size_t headersOffset = alignUp(offset, 8);
+
+	Elf64_Ehdr header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.e_ident, ELFMAG, SELFMAG);
+	header.e_ident[EI_CLASS] = ELFCLASS64;
+	header.e_ident[EI_DATA] = ELFDATA2LSB;
+	header.e_ident[EI_VERSION] = EV_CURRENT;
+	header.e_ident[EI_OSABI] = ELFOSABI_NONE;
+	header.e_type = executable ? ET_EXEC : ET_REL;
+	header.e_machine = EM_AARCH64;
+	header.e_version = EV_CURRENT;
+	header.e_shoff = headersOffset;
+	header.e_ehsize = sizeof(Elf64_Ehdr);
+	header.e_shentsize = sizeof(Elf64_Shdr);
+	header.e_shnum = sectionCount;
+	header.e_shstrndx = SH_SHSTRTAB;
+
+	Elf64_Phdr segments[2];
+	memset(segments, 0, sizeof(segments));
+
+	if (executable) {
+		int entry = labels->find("_start");
+		if (entry == -1 || entry >= (int) symbols.size() || symbols[entry].section != SECTION_TEXT) {
+			abort("No _start to begin the executable at");
+		}
+
+		header.e_entry = base[SECTION_TEXT] + address(entry);
+		header.e_phoff = sizeof(Elf64_Ehdr);
+		header.e_phentsize = sizeof(Elf64_Phdr);
+		header.e_phnum = segmentCount;
+
+		size_t textEnd = headers[SH_TEXT].sh_offset + code.size();
+		segments[0] = {PT_LOAD, PF_R | PF_X, 0, LOAD_ADDRESS, LOAD_ADDRESS, textEnd, textEnd, SEGMENT_ALIGNMENT};
+
+		size_t memorySize = base[SECTION_BSS] + bssSize - base[SECTION_DATA];
+		segments[1] = {PT_LOAD, PF_R | PF_W, headers[SH_DATA].sh_offset, base[SECTION_DATA], base[SECTION_DATA], data.size(), memorySize, SEGMENT_ALIGNMENT};
+	}
+
+	// Everything goes out with one writev, padding included
+	static const char zeros[8] = {0};
+	vector<iovec> iov;
+	size_t written = 0;
+	auto append = [&](const void* from, size_t size, size_t at) {
+		if (at > written) iov.push_back({(void*) zeros, at - written});
+		if (size > 0) iov.push_back({(void*) from, size});
+		written = at + size;
+	};
+
+	append(&header, sizeof(header), 0);
+	append(segments, segmentCount * sizeof(Elf64_Phdr), sizeof(header));
+	append(code.data(), code.size(), headers[SH_TEXT].sh_offset);
+	append(data.data(), data.size(), headers[SH_DATA].sh_offset);
+	append(symbolTable.data(), headers[SH_SYMTAB].sh_size, headers[SH_SYMTAB].sh_offset);
+	append(strings.data(), strings.size(), headers[SH_STRTAB].sh_offset);
+	append(sectionNames.data(), sectionNames.size(), headers[SH_SHSTRTAB].sh_offset);
+	if (!executable) append(relocations.data(), headers[SH_RELA].sh_size, headers[SH_RELA].sh_offset);
+	append(headers, sectionCount * sizeof(Elf64_Shdr), headersOffset);
+
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, executable ? 0755 : 0644);
+	if (fd < 0) {
+		abort("Cannot open file " + path);
+	}
+
+	if (!writeAll(fd, iov)) {
+		abort("Cannot write file " + path);
+	}
+	close(fd);
+}
+
+#endif
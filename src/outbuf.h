@@ -0,0 +1,112 @@
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <cstring>
+#include <sys/uio.h>
+#include <climits>
+#include <cerrno>
+
+#ifndef OUTBUF_H
+#define OUTBUF_H
+using namespace std;
+
+// Output buffer :
+/*
+	Append-only text made of fixed size chunks. Appends copy straight into the
+	last chunk, so nothing is reallocated or moved as a section grows, and the
+	chunks go to writev as they are when the file is written.
+*/
+class OutputBuffer {
+	public:
+		OutputBuffer();
+		void append(string_view text);
+		void append(char c);
+		void clear();
+		size_t size();
+		void gather(vector<iovec>& iov);
+		void newChunk();
+
+		static const size_t CHUNK_SIZE = 64 * 1024;
+
+		vector<unique_ptr<char[]>> chunks;
+		size_t chunkCount;	// chunks in use, clear() keeps the rest around to reuse
+		size_t lastUsed;	// bytes used in the last chunk in use
+};
+
+OutputBuffer::OutputBuffer() {
+	chunkCount = 0;
+	lastUsed = CHUNK_SIZE;
+}
+
+void OutputBuffer::newChunk() {
+	if (chunkCount == chunks.size()) chunks.emplace_back(new char[CHUNK_SIZE]);
+	chunkCount++;
+	lastUsed = 0;
+}
+
+void OutputBuffer::append(string_view text) {
+	while (!text.empty()) {
+		if (lastUsed == CHUNK_SIZE) newChunk();
+
+		size_t count = min(text.length(), CHUNK_SIZE - lastUsed);
+		memcpy(chunks[chunkCount - 1].get() + lastUsed, text.data(), count);
+
+		lastUsed += count;
+		text.remove_prefix(count);
+	}
+}
+
+void OutputBuffer::append(char c) {
+	if (lastUsed == CHUNK_SIZE) newChunk();
+	chunks[chunkCount - 1][lastUsed++] = c;
+}
+
+// Empties the buffer, but holds on to the chunks
+void OutputBuffer::clear() {
+	chunkCount = 0;
+	lastUsed = CHUNK_SIZE;
+}
+
+size_t OutputBuffer::size() {
+	if (chunkCount == 0) return 0;
+	return (chunkCount - 1) * CHUNK_SIZE + lastUsed;
+}
+
+// Adds one iovec per chunk in use, in order
+void OutputBuffer::gather(vector<iovec>& iov) {
+	for (size_t i = 0; i < chunkCount; i++) {
+		size_t length = (i + 1 == chunkCount) ? lastUsed : CHUNK_SIZE;
+		iov.push_back({chunks[i].get(), length});
+	}
+}
+
+// Writes every iovec to fd, IOV_MAX at a time, picking up after short writes.
+// Returns 1 on success, 0 on failure
+int writeAll(int fd, vector<iovec>& iov) {
+	size_t next = 0;
+
+	while (next < iov.size()) {
+		int count = min(iov.size() - next, (size_t) IOV_MAX);
+		ssize_t written = writev(fd, &iov[next], count);
+
+		if (written < 0) {
+			if (errno == EINTR) continue;
+			return 0;
+		}
+
+		while (next < iov.size() && (size_t) written >= iov[next].iov_len) { // drop whatever was fully written
+			written -= iov[next].iov_len;
+			next++;
+		}
+
+		if (written > 0) { // partly written, the rest goes out next time
+			iov[next].iov_base = (char*) iov[next].iov_base + written;
+			iov[next].iov_len -= written;
+		}
+	}
+
+	return 1;
+}
+
+#endif
@@ -1,166 +1,46 @@
 #include "lexer.h"
-#include "emitter.h"
+#include "ir.h"
+#include "trace.h"
 #include <vector>
 #include <algorithm>
 
 using namespace std;
 
-struct functionParams {
-	string name;
-	vector<string> params;
-};
-
-class FunctionMap {
-	public:
-		FunctionMap() {}
-		
-		int exists(string name) { // helper function to figure out if an entry exists
-			if (find(functions.begin(), functions.end(), name) == functions.end()) return 0;
-			else return 1;
-		}
-
-		int paramExists(string name, string param) { // check to see a param is already defined -- maybe not useful
-			for (int i = 0; i < paramMap.size(); i++) {
-				if (paramMap[i].name == name) {
-					for (int j = 0; j < paramMap[i].params.size(); i++) {
-						if (paramMap[i].params[j] == param) return 1;
-					}
-				}
-			}
-			return 0;
-		}
-
-
-		/*	TOP	  BOT
-		 *	
-		 *	[] [] lr fp|sp	2 params, 
-		 *	0  1
-		 *	3  2
-		 *	24 16 8  0
-		 *
-		 *	[] [] [] [-] lr fp|sp
-		 *	0  1  2
-		 *	5  4  3
-		 *	40 32 24 16  8  0
-		 */
-		string getParamOffset(vector<string> params, string param) {
-			int idx = find(params.begin(), params.end(), param) - params.begin();
-
-			int posFromBack;
-				
-			if (params.size() % 2 != 0) { 
-				posFromBack = params.size() - idx + 2;
-			} else { // for an odd number of params, the offset will be 16 aligned, so there's 8 bytes in padding
-				posFromBack = params.size() - idx + 1;
-			}
-
-			posFromBack *= 8; // 8 bytes per element
-
-			return "#" + to_string(posFromBack);
-		}
-
-		string getLabel(string name) { 	// helper function to get the label for each function
-			int idx = find(functions.begin(), functions.end(), name) - functions.begin();
-
-			return "FUNC" + idx;
-		}
-
-		vector<string> getParams(string name) { // return the params listed under a function label
-			for (int i = 0; i < paramMap.size(); i++) {
-				if (paramMap[i].name == name) return paramMap[i].params;
-			}
-			return {};
-		}
-
-		void push_name(string name) { // should be called before push_back 
-			functions.push_back(name);
-		}
-
-		void push_back(string name, vector<string> params = {}) {
-			functionParams entry;
-			entry.name = name;
-			entry.params = params;
-
-			paramMap.push_back(entry);
-		}
-
-		vector<functionParams> paramMap;
-		vector<string> functions;
-};
-
-class SymbolMap {
-	public:
-		SymbolMap() {
-		}
-
-		string getLabel(string name) {
-			int index = find(symbols.begin(), symbols.end(), name) - symbols.begin();
-
-			return "V" + to_string(index);
-		}
-
-		string getLabel(int index) {
-			return "V" + to_string(index);
-		}
-
-		int exists(string name) {
-			if (find(symbols.begin(), symbols.end(), name) == symbols.end()) return 0; // doesn't exist
-			else return 1; // exists
-		}
-
-		void push_back(string name) {
-			symbols.push_back(name);
-		}
-
-		int size() {
-			return symbols.size();
-		}
-
-		vector<string> symbols;
-};
-
+// Parser object :
+/*
+	Checks the syntax and builds the IR for the program into an IrProgram.
+	Nothing is emitted here, the CodeGenerator lowers the IR afterwards.
+*/
 class Parser {
 	public:
-		Parser(Lexer& inputLexer, Emitter& inputEmitter);
+		Parser(Lexer& inputLexer, IrProgram& inputIr);
 		void abort(string message);
 		int checkToken(TOKEN_TYPE kind);
 		int checkPeek(TOKEN_TYPE kind);
 		void nextToken();
 		void match(TOKEN_TYPE kind);
-		// Sytanx function declarations
+		// Sytanx function declarations, each returns the IR node it built
 		void program();
-		void statement(TOKEN_TYPE caller = TOKEN_TYPE::INVALID, vector<string> parameters = {});
+		int statement(TOKEN_TYPE caller = TOKEN_TYPE::INVALID, FunctionScope& scope = NO_SCOPE);
+		int block(TOKEN_TYPE caller, FunctionScope& scope, TOKEN_TYPE end, TOKEN_TYPE alsoEnd = TOKEN_TYPE::INVALID);
 		void nl();
-		void expression(TOKEN_TYPE caller = TOKEN_TYPE::INVALID, vector<string> parameters = {});
-		void term(TOKEN_TYPE caller = TOKEN_TYPE::INVALID, vector<string> parameters = {});
-		void unary(TOKEN_TYPE caller = TOKEN_TYPE::INVALID, vector<string> parameters = {});
-		void primary(TOKEN_TYPE caller = TOKEN_TYPE::INVALID, vector<string> parameters = {});
-		void condition(string exitLabel, TOKEN_TYPE caller = TOKEN_TYPE::INVALID, vector<string> parameters = {});
+		int expression(FunctionScope& scope = NO_SCOPE);
+		int term(FunctionScope& scope = NO_SCOPE);
+		int unary(FunctionScope& scope = NO_SCOPE);
+		int primary(FunctionScope& scope = NO_SCOPE);
+		int condition(FunctionScope& scope = NO_SCOPE);
+		int declaration(TOKEN_TYPE type, FunctionScope& scope);
 
 		Lexer& lexer;
-		Emitter& emitter;
+		IrProgram& ir;
 		Token curToken;
 		Token peekToken;
 
-		SymbolMap symbolMap;
-		FunctionMap functionMap;
-
-		vector <string> labels;
-		vector <string> gotos;
-		vector <string> stringLiterals;
-		vector <string> functions;
-		
-
-		int ifCount;
-		int whileCount;
-
-//		vector<int> registerFile(32, 0);
+		vector <int> gotos;		// label ids, in the order the GOTOs appear
+		vector <char> labelDeclared;	// indexed by label id
 };
 
-Parser::Parser(Lexer& inputLexer, Emitter& inputEmitter) : lexer(inputLexer), emitter(inputEmitter) {
-	ifCount = 0;
-	whileCount = 0;
-
+Parser::Parser(Lexer& inputLexer, IrProgram& inputIr) : lexer(inputLexer), ir(inputIr) {
 	nextToken();
 	nextToken();
 }
@@ -202,498 +82,260 @@ void Parser::match(TOKEN_TYPE kind) {
 
 // Program is made of statements. Do each one until you reach the end
 void Parser::program() {
-	cout << "PROGRAM\n";
-
-	emitter.headerLine(".global _start");
-	emitter.headerLine(".text");
-	emitter.headerLine("\n_start:");
+	TRACE(TRACE_PARSER, "PROGRAM\n");
 
 	while (checkToken(TOKEN_TYPE::NEWLINE) == 1) nextToken();
 
+	int last = -1;
 	while (checkToken(TOKEN_TYPE::END) != 1) {
-		statement();
+		ir.append(ir.main, last, statement());
 	}
 
 	for (int i = 0; i < gotos.size(); i++) {
-		if (find(labels.begin(), labels.end(), gotos[i]) == labels.end()) {
-			abort("Attemping to GOTO undeclared label, " + gotos[i]);
+		if (!labelDeclared[gotos[i]]) {
+			abort("Attemping to GOTO undeclared label, " + ir.labels.names[gotos[i]]);
 		}
 	}
+}
 
-	for (int i = 0; i < symbolMap.size(); i++) {
-		emitter.dataLine(symbolMap.getLabel(i) + ": .quad 0");
-	}
+// Statements up to (not including) the end token, chained into a block. Returns the first one, -1 if empty
+int Parser::block(TOKEN_TYPE caller, FunctionScope& scope, TOKEN_TYPE end, TOKEN_TYPE alsoEnd) {
+	int first = -1;
+	int last = -1;
 
-	for (int i = 0; i < stringLiterals.size(); i++) {
-		string label = "S" + to_string(i);
-		emitter.dataLine(label + ": .asciz \"" + stringLiterals[i] + "\"");
-		emitter.dataLine(label + "_len = . - " + label);
+	while (checkToken(end) == 0 && checkToken(alsoEnd) == 0) {
+		if (checkToken(TOKEN_TYPE::END)) abort("Expected " + tokenTypeToString(end) + ", reached the end of the file");
+		ir.append(first, last, statement(caller, scope));
 	}
 
-	emitter.emitLine("mov x8, #93");
-	emitter.emitLine("mov x0, #0");
-	emitter.emitLine("svc #0");
+	return first;
 }
 
-void Parser::statement(TOKEN_TYPE caller, vector<string> parameters) {
-	// Print statement
-	if (caller == TOKEN_TYPE::FUNC) { // -------------------------------------------------------------- IN-FUNCTION STATEMENTS	
-		if (checkToken(TOKEN_TYPE::PRINT)) { // Should be PRINT - STRING | EXPRESSION - NL
-			cout << "FUNC-STATEMENT-PRINT\n";
-			nextToken();
-
-			if (checkToken(TOKEN_TYPE::STRING)) { // String is for a literal, text is keyword to define variable
-				// check literals table for copy, add it if not.
-				if (find(stringLiterals.begin(), stringLiterals.end(), curToken.text) == stringLiterals.end()) stringLiterals.push_back(curToken.text);
+int Parser::statement(TOKEN_TYPE caller, FunctionScope& scope) {
+	string prefix = (caller == TOKEN_TYPE::FUNC) ? "FUNC-" : ""; // only for the trace
+	int id = -1;
 
-				int index = find(stringLiterals.begin(), stringLiterals.end(), curToken.text) - stringLiterals.begin();
+	if (checkToken(TOKEN_TYPE::PRINT)) { // Should be PRINT - STRING | EXPRESSION - NL
+		TRACE(TRACE_PARSER, prefix << "STATEMENT-PRINT\n");
+		nextToken();
 
-				emitter.functionLine("mov x0, #1");
-				emitter.functionLine("adr x1, S" + to_string(index));
-				emitter.functionLine("ldr x2, =S" + to_string(index) + "_len");
-				emitter.functionLine("mov x8, #64");
-				emitter.functionLine("svc #0");
+		if (checkToken(TOKEN_TYPE::STRING)) { // String is for a literal, text is keyword to define variable
+			// literals table gives back the existing index for a copy, adds it if not.
+			id = ir.add(IR_PRINT, ir.stringLiterals.insert(curToken.text));
 
-				nextToken();
-			} else {
-				abort("Print expression not yet implemented");
-				expression(caller, parameters);
-			}
-		} else if (checkToken(TOKEN_TYPE::IF)) { // IF condition THEN statement ENDIF
-			
-
-			cout << "STATEMENT-IF\n";
 			nextToken();
-			condition("XIF" + to_string(ifCount), caller);
-
-			match(TOKEN_TYPE::THEN);
-			nl();
+		} else {
+			id = ir.add(IR_PRINT_VALUE, expression(scope));
+		}
+	} else if (checkToken(TOKEN_TYPE::IF)) { // IF condition THEN statement ENDIF
+		TRACE(TRACE_PARSER, prefix << "STATEMENT-IF\n");
+		nextToken();
+		int cond = condition(scope);
 
-			while (checkToken(TOKEN_TYPE::ENDIF) == 0 && checkToken(TOKEN_TYPE::ELSE) == 0) {
-				statement(caller);
-			}
-			emitter.functionLine("b XELSE" + to_string(ifCount));
+		match(TOKEN_TYPE::THEN);
+		nl();
 
-			emitter.functionLine("XIF" + to_string(ifCount) + ":");
-			
-			if (checkToken(TOKEN_TYPE::ELSE)) { // IF condition THEN {statement} ELSE {statement} ENDIF
-				cout << "ELSE-BRANCH\n";
-				nextToken();
-				nl();
+		int thenBlock = block(caller, scope, TOKEN_TYPE::ENDIF, TOKEN_TYPE::ELSE);
+		int elseBlock = -1;
 
-				while (checkToken(TOKEN_TYPE::ENDIF) == 0) {
-					statement(caller);
-				}
-			}
-
-			match(TOKEN_TYPE::ENDIF);
-			
-			
-			emitter.functionLine("XELSE" + to_string(ifCount) + ":");
-			ifCount++;
-		} else if (checkToken(TOKEN_TYPE::WHILE)) { // WHILE condition DO statement ENDWHILE
-			cout << "FUNC-STATEMENT-WHILE\n";
+		if (checkToken(TOKEN_TYPE::ELSE)) { // IF condition THEN {statement} ELSE {statement} ENDIF
+			TRACE(TRACE_PARSER, "ELSE-BRANCH\n");
 			nextToken();
-			emitter.functionLine("SWHILE" + to_string(whileCount) + ":");
-
-			condition("XWHILE" + to_string(whileCount), caller, parameters);
-			
-			match(TOKEN_TYPE::DO);
 			nl();
 
-			while (checkToken(TOKEN_TYPE::ENDWHILE) == 0) {
-				statement(caller, parameters);
-			}
-			match(TOKEN_TYPE::ENDWHILE);
-			
-			emitter.functionLine("B SWHILE" + to_string(whileCount)); 
-			emitter.functionLine("XWHILE" + to_string(whileCount) + ":");
-			whileCount++;
-
-		} else if (checkToken(TOKEN_TYPE::FUNC)) { // FUNC identifier IS nl {statement} ENDFUNC nl
-			abort("Cannot define a function inside of a function");
-		} else if (checkToken(TOKEN_TYPE::LABEL)) { // LABEL identifier
-			abort("Cannot put a label inside a function");
-		} else if (checkToken(TOKEN_TYPE::GOTO)) { // GOTO identifier
-			cout << "FUNC-STATEMENT-GOTO\n";
-			nextToken();
-			gotos.push_back(curToken.text); // add to the GOTOs list
-
-			emitter.functionLine("b L" + curToken.text);
-			match(TOKEN_TYPE::IDENTIFIER);
-		} else if (checkToken(TOKEN_TYPE::INT)) { // INT identifier = expression
-			cout << "FUNC-STATEMENT-INT\n";
-			nextToken();
-
-			if (symbolMap.exists(curToken.text)) {
-				abort("Symbol (" + curToken.text + ") is already declared.");
-			}
-
-			symbolMap.push_back(curToken.text);
-			string identLabel = symbolMap.getLabel(curToken.text);
-
-			match(TOKEN_TYPE::IDENTIFIER);
-			match(TOKEN_TYPE::EQ);
-
-			expression(caller, parameters);
-
-			emitter.functionLine("adr x13, " + identLabel);
-			emitter.functionLine("str x11, [x13]");
-
-		} else if (checkToken(TOKEN_TYPE::FLOAT)) { // FLOAT identifier = expression
-			cout << "FUNC-STATEMENT-FLOAT\n";
-			nextToken();
-
-			if (symbolMap.exists(curToken.text)) {
-				abort("Symbol (" + curToken.text + ") is already declared.");
-			} else {
-				symbolMap.push_back(curToken.text);
-			}
-			string identLabel = symbolMap.getLabel(curToken.text);
-
-			match(TOKEN_TYPE::IDENTIFIER);
-			match(TOKEN_TYPE::EQ);
-
-			expression(caller, parameters);
-
-			emitter.functionLine("adr x13, " + identLabel);
-			emitter.functionLine("str x11, [x13]");
-
-		} else if (checkToken(TOKEN_TYPE::TEXT)) { // TEXT identifier = expression
-			cout << "FUNC-STATEMENT-TEXT\n";
-			nextToken();
-
-			if (symbolMap.exists(curToken.text)) {
-				abort("Symbol (" + curToken.text + ") is already declared.");
-			} else {
-				symbolMap.push_back(curToken.text);
-			}
-
-			string identLabel = symbolMap.getLabel(curToken.text);
-
-			match(TOKEN_TYPE::IDENTIFIER);
-			match(TOKEN_TYPE::EQ);
-
-			expression(caller, parameters);
+			elseBlock = block(caller, scope, TOKEN_TYPE::ENDIF);
+		}
 
-			emitter.functionLine("adr x13, " + identLabel);
-			emitter.functionLine("str x10, [x13]");
+		match(TOKEN_TYPE::ENDIF);
 
-		} else if (checkToken(TOKEN_TYPE::IDENTIFIER)) {// identifier "=" expression
-			cout << "FUNC-STATEMENT-ASSIGN\n";
+		id = ir.add(IR_IF, cond, thenBlock, elseBlock);
+	} else if (checkToken(TOKEN_TYPE::WHILE)) { // WHILE condition DO statement ENDWHILE
+		TRACE(TRACE_PARSER, prefix << "STATEMENT-WHILE\n");
+		nextToken();
 
-			if (!symbolMap.exists(curToken.text)) {
-				abort("Symbol (" + curToken.text + ") does not exist.");
-			}
+		int cond = condition(scope);
 
-			string identLabel = symbolMap.getLabel(curToken.text);
-			nextToken();
+		match(TOKEN_TYPE::DO);
+		nl();
 
-			match(TOKEN_TYPE::EQ);
+		int body = block(caller, scope, TOKEN_TYPE::ENDWHILE);
+		match(TOKEN_TYPE::ENDWHILE);
 
-			expression(caller, parameters);
+		id = ir.add(IR_WHILE, cond, body);
+	} else if (checkToken(TOKEN_TYPE::FUNC)) { // FUNC identifier IS nl {statement} ENDFUNC nl
+		if (caller == TOKEN_TYPE::FUNC) {
+			abort("Cannot define a function inside of a function");
+		}
 
-			emitter.functionLine("adr x13, " + identLabel);
-			emitter.functionLine("str x11, [x13]");
-		
-		} else if (checkToken(TOKEN_TYPE::DO)) { // "DO" identifier
-			cout << "STATEMENT-FUNCTIONCALL";
-			nextToken();
-			cout << " (" + curToken.text + ")";
-			if (!functionMap.exists(curToken.text)) {
-				abort("Function " + curToken.text + " does not exist");
-			}
-				
-			string bLabel = functionMap.getLabel(curToken.text);
+		TRACE(TRACE_PARSER, "STATEMENT-FUNCTION\n");
+		nextToken();
 
-			emitter.functionLine("bl " + bLabel);
-			match(TOKEN_TYPE::IDENTIFIER);
-		} else {
-			abort("Invalid state at " + string(curToken.text) + " (" + tokenTypeToString(curToken.type) + ").");
+		if (ir.functionMap.exists(curToken.text)) {
+			abort("Function (" + string(curToken.text) + ") already exists");
 		}
-	} else { // --------------------------------------------------------------------------------------------------- OUT-OF-FUNCTION STATEMENTS
-		if (checkToken(TOKEN_TYPE::PRINT)) { // Should be PRINT - STRING | EXPRESSION - NL
-			cout << "STATEMENT-PRINT\n";
-			nextToken();
-
-			if (checkToken(TOKEN_TYPE::STRING)) { // String is for a literal, text is keyword to define variable
-				// check literals table for copy, add it if not.
-				if (find(stringLiterals.begin(), stringLiterals.end(), curToken.text) == stringLiterals.end()) stringLiterals.push_back(curToken.text);
 
-				int index = find(stringLiterals.begin(), stringLiterals.end(), curToken.text) - stringLiterals.begin();
+		FunctionScope& funcScope = ir.functionMap.push_name(curToken.text);
 
-				emitter.emitLine("mov x0, #1");
-				emitter.emitLine("adr x1, S" + to_string(index));
-				emitter.emitLine("ldr x2, =S" + to_string(index) + "_len");
-				emitter.emitLine("mov x8, #64");
-				emitter.emitLine("svc #0");
+		match(TOKEN_TYPE::IDENTIFIER);
 
-				nextToken();
-			} else {
-				abort("Print expression not yet implemented");
-				expression(caller);
-			}
-		} else if (checkToken(TOKEN_TYPE::IF)) { // IF condition THEN statement ENDIF
-			cout << "STATEMENT-IF\n";
+		if (checkToken(TOKEN_TYPE::USING)) { // FUNC identifier USING identifier {"," identifier} IS ...
+			TRACE(TRACE_PARSER, "\tPARAMETERS\n");
 			nextToken();
-			condition("XIF" + to_string(ifCount), caller);
-
-			match(TOKEN_TYPE::THEN);
-			nl();
 
-			while (checkToken(TOKEN_TYPE::ENDIF) == 0 && checkToken(TOKEN_TYPE::ELSE) == 0) {
-				statement(caller);
-			}
-			emitter.emitLine("b XELSE" + to_string(ifCount));
+			funcScope.params.insert(curToken.text);
+			match(TOKEN_TYPE::IDENTIFIER);
 
-			emitter.emitLine("XIF" + to_string(ifCount) + ":");
-			
-			if (checkToken(TOKEN_TYPE::ELSE)) { // IF condition THEN {statement} ELSE {statement} ENDIF
-				cout << "ELSE-BRANCH\n";
-				nextToken();
-				nl();
+			while (checkToken(TOKEN_TYPE::IS) == 0) {
+				match(TOKEN_TYPE::COMMA);
 
-				while (checkToken(TOKEN_TYPE::ENDIF) == 0) {
-					statement(caller);
+				if (funcScope.slot(curToken.text) != -1) {
+					abort("Function parameter (" + string(curToken.text) + ") already exists");
 				}
-			}
 
-			match(TOKEN_TYPE::ENDIF);
-			
-			
-			emitter.emitLine("XELSE" + to_string(ifCount) + ":");
-			ifCount++;
+				if (ir.symbolMap.exists(curToken.text)) {
+					abort("Symbol (" + string(curToken.text) + ") exists outside of the function");
+				}
 
-		} else if (checkToken(TOKEN_TYPE::WHILE)) { // WHILE condition DO statement ENDWHILE
-			cout << "STATEMENT-WHILE\n";
-			nextToken();
-			emitter.emitLine("SWHILE" + to_string(whileCount) + ":");
+				funcScope.params.insert(curToken.text);
 
-			condition("XWHILE" + to_string(whileCount), caller);
-			
-			match(TOKEN_TYPE::DO);
-			nl();
-
-			while (checkToken(TOKEN_TYPE::ENDWHILE) == 0) {
-				statement(caller);
+				match(TOKEN_TYPE::IDENTIFIER);
 			}
-			match(TOKEN_TYPE::ENDWHILE);
-			
-			emitter.emitLine("B SWHILE" + to_string(whileCount)); 
-			emitter.emitLine("XWHILE" + to_string(whileCount) + ":");
-			whileCount++;
-
-		} else if (checkToken(TOKEN_TYPE::FUNC)) { // FUNC identifier IS nl {statement} ENDFUNC nl
-			cout << "STATEMENT-FUNCTION\n";
-			nextToken();
+		}
 
-			if (functionMap.exists(curToken.text)) {
-				abort("Function (" + curToken.text + ") already exists");
-			}
+		match(TOKEN_TYPE::IS);
+		nl();
 
-			functionMap.push_name(curToken.text);
+		int body = block(TOKEN_TYPE::FUNC, funcScope, TOKEN_TYPE::ENDFUNC);
 
-			string funcIdentifier = curToken.text;
-			string bLabel = functionMap.getLabel(curToken.text);	
-			emitter.functionLine(bLabel + ":");
+		match(TOKEN_TYPE::ENDFUNC);
 
-			emitter.functionLine("stp fp, lr, [sp, #-16]!");
+		id = ir.add(IR_FUNC, funcScope.function, body);
+	} else if (checkToken(TOKEN_TYPE::LABEL)) { // LABEL identifier
+		if (caller == TOKEN_TYPE::FUNC) {
+			abort("Cannot put a label inside a function");
+		}
 
-			match(TOKEN_TYPE::IDENTIFIER);
-			
-			vector<string> params;
+		TRACE(TRACE_PARSER, "STATEMENT-LABEL\n");
+		nextToken();
 
-			if (checkToken(TOKEN_TYPE::USING)) { // FUNC identifier USING identifier {"," identifier} IS ...
-				cout << "\tPARAMETERS\n";
-				nextToken();
+		int label = ir.labels.insert(curToken.text);
+		labelDeclared.resize(ir.labels.size(), 0);
 
-				params.push_back(curToken.text);
-				match(TOKEN_TYPE::IDENTIFIER);
-				
-				while (checkToken(TOKEN_TYPE::IS) == 0) {
-					match(TOKEN_TYPE::COMMA);
-					
-					if (find(params.begin(), params.end(), curToken.text) != params.end()) {
-						abort("Function parameter (" + curToken.text + ") already exists");
-					}
-					
-					if (symbolMap.exists(curToken.text)) {
-						abort("Symbol (" + curToken.text + ") exists outside of the function");
-					}
-
-					params.push_back(curToken.text);
-
-					match(TOKEN_TYPE::IDENTIFIER);
-				}
+		if (labelDeclared[label]) { // label was already declared
+			abort("Label (" + string(curToken.text) + ") already exists");
+		}
+		labelDeclared[label] = 1;
 
-				functionMap.push_back(funcIdentifier, params);
-			}
+		id = ir.add(IR_LABEL, label);
+		match(TOKEN_TYPE::IDENTIFIER);
+	} else if (checkToken(TOKEN_TYPE::GOTO)) { // GOTO identifier
+		TRACE(TRACE_PARSER, prefix << "STATEMENT-GOTO\n");
+		nextToken();
 
-			match(TOKEN_TYPE::IS);
-			nl();
+		int label = ir.labels.insert(curToken.text);
+		labelDeclared.resize(ir.labels.size(), 0);
+		gotos.push_back(label); // add to the GOTOs list
 
-			while (!checkToken(TOKEN_TYPE::ENDFUNC)) {
-				statement(TOKEN_TYPE::FUNC, params);
-			}
+		id = ir.add(IR_GOTO, label);
+		match(TOKEN_TYPE::IDENTIFIER);
+	} else if (checkToken(TOKEN_TYPE::INT) || checkToken(TOKEN_TYPE::FLOAT) || checkToken(TOKEN_TYPE::TEXT)) { // INT | FLOAT | TEXT identifier = expression
+		TRACE(TRACE_PARSER, prefix << "STATEMENT-" << tokenTypeToString(curToken.type) << "\n");
+		TOKEN_TYPE type = curToken.type;
+		nextToken();
 
-			match(TOKEN_TYPE::ENDFUNC);
-			
+		id = declaration(type, scope);
+	} else if (checkToken(TOKEN_TYPE::IDENTIFIER)) { // identifier "=" expression
+		TRACE(TRACE_PARSER, prefix << "STATEMENT-ASSIGN\n");
 
-			emitter.functionLine("ldp fp, lr, [sp], #16");
-			
-			emitter.functionLine("add sp, sp, #" + to_string((params.size() + params.size() % 2) * 8));
+		int local = scope.local(curToken.text);
+		int symbol = ir.symbolMap.find(curToken.text);
+		if (symbol == -1 && local == -1) {
+			abort("Symbol (" + string(curToken.text) + ") does not exist.");
+		}
 
-			emitter.functionLine("br lr");
+		nextToken();
 
-		} else if (checkToken(TOKEN_TYPE::LABEL)) { // LABEL identifier
-			cout << "STATEMENT-LABEL\n";
-			nextToken();
+		match(TOKEN_TYPE::EQ);
 
-			if (find(labels.begin(), labels.end(), curToken.text) != labels.end()) { // element exists if != to the end of labels
-				abort("Label (" + curToken.text + ") already exists"); 
-			}
-			labels.push_back(curToken.text);
+		if (local != -1) id = ir.add(IR_ASSIGN_LOCAL, local, expression(scope), scope.function);
+		else id = ir.add(IR_ASSIGN, symbol, expression(scope));
+	} else if (checkToken(TOKEN_TYPE::DO)) { // "DO" identifier
+		TRACE(TRACE_PARSER, "STATEMENT-FUNCTIONCALL");
+		nextToken();
+		TRACE(TRACE_PARSER, " (" << curToken.text << ")\n");
+		if (!ir.functionMap.exists(curToken.text)) {
+			abort("Function " + string(curToken.text) + " does not exist");
+		}
 
-			emitter.emitLine("L" + curToken.text + ":");
-			match(TOKEN_TYPE::IDENTIFIER);
-		} else if (checkToken(TOKEN_TYPE::GOTO)) { // GOTO identifier
-			cout << "STATEMENT-GOTO\n";
-			nextToken();
+		string branchIdentifier(curToken.text);
+		const FunctionScope& callee = ir.functionMap.getScope(curToken.text);
+		match(TOKEN_TYPE::IDENTIFIER);
 
-			gotos.push_back(curToken.text); // add to the GOTOs list
+		int firstArg = -1;
+		int lastArg = -1;
+		int paramCount = 0;
 
-			emitter.emitLine("b L" + curToken.text);
-			match(TOKEN_TYPE::IDENTIFIER);
-		} else if (checkToken(TOKEN_TYPE::INT)) { // INT identifier = expression
-			cout << "STATEMENT-INT\n";
+		if (checkToken(TOKEN_TYPE::WITH)) { // "DO" identifier "WITH" expression {"," expression}
+			TRACE(TRACE_PARSER, "\nFUNCTIONCALL-PARAMETERS\n");
 			nextToken();
 
-			if (symbolMap.exists(curToken.text)) {
-				abort("Symbol (" + curToken.text + ") is already declared.");
-			}
-
-			symbolMap.push_back(curToken.text);
-			string identLabel = symbolMap.getLabel(curToken.text);
-
-			match(TOKEN_TYPE::IDENTIFIER);
-			match(TOKEN_TYPE::EQ);
+			paramCount = 1;
+			ir.append(firstArg, lastArg, expression(scope));
 
-			expression(caller);
-
-			emitter.emitLine("adr x13, " + identLabel);
-			emitter.emitLine("str x11, [x13]");
-
-		} else if (checkToken(TOKEN_TYPE::FLOAT)) { // FLOAT identifier = expression
-			cout << "STATEMENT-FLOAT\n";
-			nextToken();
+			while (checkToken(TOKEN_TYPE::NEWLINE) == 0) {
+				match(TOKEN_TYPE::COMMA);
+				paramCount++;
 
-			if (symbolMap.exists(curToken.text)) {
-				abort("Symbol (" + curToken.text + ") is already declared.");
-			} else {
-				symbolMap.push_back(curToken.text);
+				ir.append(firstArg, lastArg, expression(scope));
 			}
-			string identLabel = symbolMap.getLabel(curToken.text);
 
-			match(TOKEN_TYPE::IDENTIFIER);
-			match(TOKEN_TYPE::EQ);
-
-			expression(caller);
-
-			emitter.emitLine("adr x13, " + identLabel);
-			emitter.emitLine("str x11, [x13]");
-
-		} else if (checkToken(TOKEN_TYPE::TEXT)) { // TEXT identifier = expression
-			cout << "STATEMENT-TEXT\n";
-			nextToken();
-
-			if (symbolMap.exists(curToken.text)) {
-				abort("Symbol (" + curToken.text + ") is already declared.");
-			} else {
-				symbolMap.push_back(curToken.text);
+			if (paramCount != callee.size()) {
+				abort("Function (" + branchIdentifier + ") expects " + to_string(callee.size()) + " parameters, only recieved " + to_string(paramCount));
 			}
-
-			string identLabel = symbolMap.getLabel(curToken.text);
-
-			match(TOKEN_TYPE::IDENTIFIER);
-			match(TOKEN_TYPE::EQ);
-
-			expression(caller);
-
-			emitter.emitLine("adr x13, " + identLabel);
-			emitter.emitLine("str x10, [x13]");
-
-		} else if (checkToken(TOKEN_TYPE::IDENTIFIER)) { // identifier "=" expression
-			cout << "STATEMENT-ASSIGN\n";
-
-			if (!symbolMap.exists(curToken.text)) {
-				abort("Symbol (" + curToken.text + ") does not exist.");
+		} else {
+			if (callee.size() != 0) {
+				abort("Function (" + branchIdentifier + ") expects arguments");
 			}
+		}
 
-			string identLabel = symbolMap.getLabel(curToken.text);
-			nextToken();
-
-			match(TOKEN_TYPE::EQ);
-
-			expression(caller);
+		id = ir.add(IR_CALL, callee.function, firstArg, paramCount);
+	} else {
+		abort("Invalid state at " + string(curToken.text) + " (" + tokenTypeToString(curToken.type) + ").");
+	}
 
-			emitter.emitLine("adr x13, " + identLabel);
-			emitter.emitLine("str x11, [x13]");
-		} else if (checkToken(TOKEN_TYPE::DO)) { // "DO" identifier
-			cout << "STATEMENT-FUNCTIONCALL";
-			nextToken();
-			cout << " (" + curToken.text + ")\n";
-			if (!functionMap.exists(curToken.text)) {
-				abort("Function " + curToken.text + " does not exist");
-			}
-			
-			string branchIdentifier = curToken.text;
-			string bLabel = functionMap.getLabel(curToken.text);
-			//emitter.emitLine("bl " + bLabel); dont do this yet
-			match(TOKEN_TYPE::IDENTIFIER);
+	nl();
+	return id;
+}
 
+// identifier "=" expression, after INT, FLOAT or TEXT. Declares the symbol, or a local inside a function, and returns its assignment
+int Parser::declaration(TOKEN_TYPE type, FunctionScope& scope) {
+	if (ir.symbolMap.exists(curToken.text) || scope.local(curToken.text) != -1 || scope.slot(curToken.text) != -1) {
+		abort("Symbol (" + string(curToken.text) + ") is already declared.");
+	}
 
-			if (checkToken(TOKEN_TYPE::WITH)) { // "DO" identifier "WITH" expression {"," expression}
-				cout << "\nFUNCTIONCALL-PARAMETERS\n";
-				nextToken();
-				
-				int paramCount = 1;
-				expression();
+	if (scope.function != -1) {
+		if (scope.locals.size() >= MAX_LOCALS) {
+			abort("Too many variables in function, the limit is " + to_string(MAX_LOCALS));
+		}
 
-				emitter.emitLine("str x11, [sp, #-8]!");
+		int local = scope.addLocal(curToken.text, type);
 
-				while (checkToken(TOKEN_TYPE::NEWLINE) == 0) {
-					match(TOKEN_TYPE::COMMA);
-					paramCount++;
+		match(TOKEN_TYPE::IDENTIFIER);
+		match(TOKEN_TYPE::EQ);
 
-					expression();
-					emitter.emitLine("str x11, [sp, #-8]!");
-				}
-				
-				if (paramCount % 2 != 0) { // stack always has to be 16 aligned
-					emitter.emitLine("sub sp, sp, #8");			
-				}
+		return ir.add(IR_ASSIGN_LOCAL, local, expression(scope), scope.function);
+	}
 
-				if (paramCount != functionMap.getParams(branchIdentifier).size()) {
-					abort("Function (" + branchIdentifier + ") expects " + to_string(functionMap.getParams(branchIdentifier).size()) + " parameters, only recieved " + to_string(paramCount));
-				}
-			} else {
-				if (functionMap.getParams(branchIdentifier).size() != 0) {
-					abort("Function (" + branchIdentifier + ") expects arguments");
-				}
-			}
+	int symbol = ir.symbolMap.push_back(curToken.text, type);
 
-			emitter.emitLine("bl " + bLabel);
-		} else {
-			abort("Invalid state at " + string(curToken.text) + " (" + tokenTypeToString(curToken.type) + ").");
-		}
-	}
-	
+	match(TOKEN_TYPE::IDENTIFIER);
+	match(TOKEN_TYPE::EQ);
 
-	nl();
+	return ir.add(IR_ASSIGN, symbol, expression(scope));
 }
 
 void Parser::nl() {
-	cout << "NEWLINE\n";
+	TRACE(TRACE_PARSER, "NEWLINE\n");
 
 	match(TOKEN_TYPE::NEWLINE);
 
@@ -702,67 +344,44 @@ void Parser::nl() {
 	}
 }
 
-// expression ::= term {("+" | "/") term}
-void Parser::expression(TOKEN_TYPE caller, vector<string> parameters) {
-	cout << "EXPRESSION\n";
+// expression ::= term {("+" | "-") term}
+int Parser::expression(FunctionScope& scope) {
+	TRACE(TRACE_PARSER, "EXPRESSION\n");
 
-	term(caller, parameters);
-
-	if (caller == TOKEN_TYPE::FUNC) emitter.functionLine("mov x11, x10");
-	else emitter.emitLine("mov x11, x10");
+	int id = term(scope);
 
 	while (checkToken(TOKEN_TYPE::PLUS) || checkToken(TOKEN_TYPE::MINUS)) {
-		TOKEN_TYPE lastType = curToken.type;
+		IR_OP op = checkToken(TOKEN_TYPE::PLUS) ? IR_ADD : IR_SUB;
 
 		nextToken();
-		term(caller, parameters);
-
-		if (lastType == TOKEN_TYPE::PLUS) { // +
-			if (caller == TOKEN_TYPE::FUNC) emitter.functionLine("add x11, x11, x10");
-			else emitter.emitLine("add x11, x11, x10");
-		} else if (lastType == TOKEN_TYPE::MINUS) { // -
-			if (caller == TOKEN_TYPE::FUNC) emitter.functionLine("sub x11, x11, x10");
-			else emitter.emitLine("sub x11, x11, x10");
-		}
+		id = ir.add(op, id, term(scope));
 	}
-}
 
-// term ::= unary {("*" | "/") unary}
-void Parser::term(TOKEN_TYPE caller, vector<string> parameters) {
-	cout << "TERM\n";
+	return id;
+}
 
-	unary(caller, parameters); // hold each unary in r10. do operations on r9 and put the results in r10
-	
-	if (caller == TOKEN_TYPE::FUNC) emitter.functionLine("mov x10, x9");
-	else emitter.emitLine("mov x10, x9");
+// term ::= unary {("*" | "/" | "%") unary}
+int Parser::term(FunctionScope& scope) {
+	TRACE(TRACE_PARSER, "TERM\n");
 
+	int id = unary(scope);
 
 	while (checkToken(TOKEN_TYPE::ASTERISK) || checkToken(TOKEN_TYPE::SLASH) || checkToken(TOKEN_TYPE::MODULO)) {
-		TOKEN_TYPE lastType = curToken.type;
+		IR_OP op;
+		if (checkToken(TOKEN_TYPE::ASTERISK)) op = IR_MUL;
+		else if (checkToken(TOKEN_TYPE::SLASH)) op = IR_DIV;
+		else op = IR_MOD;
+
 		nextToken();
-		unary(caller, parameters);
-
-		if (lastType == TOKEN_TYPE::ASTERISK) { 	// multiply
-			if (caller == TOKEN_TYPE::FUNC) emitter.functionLine("mul x10, x10, x9");
-			else emitter.emitLine("mul x10, x10, x9");
-		} else if (lastType == TOKEN_TYPE::SLASH) { // divide
-			if (caller == TOKEN_TYPE::FUNC) emitter.functionLine("sdiv x10, x10, x9");
-			else emitter.emitLine("sdiv x10, x10, x9");
-		} else {
-			if (caller == TOKEN_TYPE::FUNC) {
-				emitter.functionLine("udiv x8, x10, x9");  		// x10 is dividend x9 is divisor x8 is quotient
-				emitter.functionLine("msub x10, x8, x9, x10");		// q = Dvnd / Dvsr + Rem -> REm = Q * 
-			} else {							// x10 = x10 - (x9 * x10) = x10 -
-				emitter.emitLine("udiv x8, x10, x9");
-				emitter.emitLine("msub x10, x8, x9, x10");
-			}
-		}
+		id = ir.add(op, id, unary(scope));
 	}
+
+	return id;
 }
 
 // unary ::= ["+" | "-"] primary
-void Parser::unary(TOKEN_TYPE caller, vector<string> parameters) {
-	cout << "UNARY\n";
+int Parser::unary(FunctionScope& scope) {
+	TRACE(TRACE_PARSER, "UNARY\n");
 
 	TOKEN_TYPE lastType = curToken.type;
 
@@ -770,95 +389,71 @@ void Parser::unary(TOKEN_TYPE caller, vector<string> parameters) {
 	if (curToken.type == TOKEN_TYPE::PLUS || curToken.type == TOKEN_TYPE::MINUS) {
 		nextToken();
 	}
-	primary(caller, parameters);
+	int id = primary(scope);
 
 	if (lastType == TOKEN_TYPE::MINUS) {
-		if (caller == TOKEN_TYPE::FUNC) emitter.functionLine("mvn x9, x9");
-		else emitter.emitLine("mvn x9, x9");
+		id = ir.add(IR_NEG, id);
 	}
+
+	return id;
 }
 
-// primary ::= number | identifier
-void Parser::primary(TOKEN_TYPE caller, vector<string> parameters) { // Primary held in r9
-	cout << "PRIMARY (" << curToken.text << ")\n";
+// primary ::= number | identifier | "(" expression ")"
+int Parser::primary(FunctionScope& scope) {
+	TRACE(TRACE_PARSER, "PRIMARY (" << curToken.text << ")\n");
+
+	int id = -1;
 
 	if (checkToken(TOKEN_TYPE::NUMBER)) {
-		if (caller == TOKEN_TYPE::FUNC) emitter.functionLine("mov x9, #" + curToken.text);
-		else emitter.emitLine("mov x9, #" + curToken.text);
+		id = ir.number(curToken.text);
 		nextToken();
 	} else if (checkToken(TOKEN_TYPE::IDENTIFIER)) {
-		if (!symbolMap.exists(curToken.text) && find(parameters.begin(), parameters.end(), curToken.text) == parameters.end()) {
-			abort("Undeclared symbol (" + curToken.text);
-		}
+		int slot = scope.slot(curToken.text);
+		int local = scope.local(curToken.text);
+		int symbol = ir.symbolMap.find(curToken.text);
 
-		if (caller == TOKEN_TYPE::FUNC) {
-			 if (!parameters.empty()) {
-			 	if (find(parameters.begin(), parameters.end(), curToken.text) != parameters.end()) {
-					emitter.functionLine("ldr x9, [sp, " + functionMap.getParamOffset(parameters, curToken.text) + "]");
-				} else {
-			 		emitter.functionLine("adr x9, " + symbolMap.getLabel(curToken.text));
-			 		emitter.functionLine("ldr x9, [x9]");
-				}
-			}
-		}
-		
-		else {
-			emitter.emitLine("adr x9, " + symbolMap.getLabel(curToken.text));
-			emitter.emitLine("ldr x9, [x9]");
+		if (symbol == -1 && slot == -1 && local == -1) {
+			abort("Undeclared symbol (" + string(curToken.text));
 		}
 
+		if (slot != -1) id = ir.add(IR_PARAM, slot, scope.function);
+		else if (local != -1) id = ir.add(IR_LOCAL, local, scope.function);
+		else id = ir.add(IR_VAR, symbol);
+
 		nextToken();
+	} else if (checkToken(TOKEN_TYPE::LPAREN)) { // the IR is already a tree, so brackets only steer the parse
+		nextToken();
+		id = expression(scope);
+		match(TOKEN_TYPE::RPAREN);
 	} else {
-		abort("Expected number or identifier, recieved " + curToken.text);
+		abort("Expected number, identifier or (, recieved " + string(curToken.text));
 	}
-}
-
-// condition ::= expression (("==" | ">" | ">=" | "<"| "<=") experssion)+
-void Parser::condition(string exitLabel, TOKEN_TYPE caller, vector<string> parameters) {
-	cout << "CONDITION\n";
 
-	expression(caller, parameters);
-	// result in r11
-	if (caller == TOKEN_TYPE::FUNC) emitter.functionLine("mov x12, x11");
-	else emitter.emitLine("mov x12, x11");
-
-	TOKEN_TYPE conditional = curToken.type;
+	return id;
+}
 
-	if (checkToken(TOKEN_TYPE::EQEQ) || checkToken(TOKEN_TYPE::NEQ) || checkToken(TOKEN_TYPE::GT) || checkToken(TOKEN_TYPE::GTEQ) || checkToken(TOKEN_TYPE::LT) || checkToken(TOKEN_TYPE::LTEQ)) {
-		nextToken();
-		expression(caller, parameters);
-	} else {
-		abort("Expected expression, got " + curToken.text);
-	}
-	
-	if (caller == TOKEN_TYPE::FUNC) emitter.functionLine("cmp x12, x11");
-	else emitter.emitLine("cmp x12, x11");
-
-	string branchType = "";
-
-	switch (conditional) {
-		case TOKEN_TYPE::EQEQ:
-			branchType = "bne ";
-			break;
-		case TOKEN_TYPE::NEQ:
-			branchType = "beq "; 
-			break;
-		case TOKEN_TYPE::GT:
-			branchType = "ble "; 	
-			break;
-		case TOKEN_TYPE::GTEQ:
-			branchType = "blt ";
-			break;
-		case TOKEN_TYPE::LT:
-			branchType = "bge ";
-			break;
-		case TOKEN_TYPE::LTEQ:
-			branchType = "bgt ";
-			break;
+// condition ::= expression (("==" | "!=" | ">" | ">=" | "<"| "<=") experssion)
+int Parser::condition(FunctionScope& scope) {
+	TRACE(TRACE_PARSER, "CONDITION\n");
+
+	int lhs = expression(scope);
+
+	IR_OP op = IR_EQ;
+	switch (curToken.type) {
+		case TOKEN_TYPE::EQEQ: op = IR_EQ; break;
+		case TOKEN_TYPE::NEQ: op = IR_NE; break;
+		case TOKEN_TYPE::GT: op = IR_GT; break;
+		case TOKEN_TYPE::GTEQ: op = IR_GE; break;
+		case TOKEN_TYPE::LT: op = IR_LT; break;
+		case TOKEN_TYPE::LTEQ: op = IR_LE; break;
+		default:
+			abort("Expected expression, got " + string(curToken.text));
 	}
 
-	if (caller == TOKEN_TYPE::FUNC) emitter.functionLine(branchType + exitLabel);
-	else emitter.emitLine(branchType + exitLabel);
+	nextToken();
+	int rhs = expression(scope);
+
+	return ir.add(op, lhs, rhs);
 
 	/* -------------- Currently removed multiple expressions w/i a condition
 	while (checkToken(TOKEN_TYPE::EQEQ) || checkToken(TOKEN_TYPE::GT) || checkToken(TOKEN_TYPE::GTEQ) || checkToken(TOKEN_TYPE::LT) || checkToken(TOKEN_TYPE::LTEQ)) {
@@ -898,7 +493,7 @@ void Parser::condition(string exitLabel, TOKEN_TYPE caller, vector<string> param
 {expression} ::= term {("-" | "+") term}
 term ::= unary {("*" | "/" | "%") unary}
 unary ::= ["-" | "+"] primary
-primary ::= number | identifier
+primary ::= number | identifier | "(" expression ")"
 condition ::= expression ((">" | ">=" | "<" | "<=" | "==") expression)+
 nl ::= '\n'+
 */
@@ -0,0 +1,260 @@
+#include <vector>
+
+#include "instr.h"
+#include "trace.h"
+
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+using namespace std;
+
+// Peephole optimizer :
+/*
+	Cleans up the instruction lists the code generator builds one statement at
+	a time, which move every value through x9, x10 and x11 and reload what
+	they just stored. Each rule looks at the instruction at one position (and
+	the few around it) and rewrites them in place, turning whatever goes away
+	into OP_NOP. The rules run over the list until none of them applies, then
+	the NOPs are dropped. Rules live in a table, so adding one is a function
+	and a line, and every rule counts how often it fired for -v.
+*/
+typedef int (*PeepholeRule)(vector<Instr>& code, size_t i);
+
+struct PeepholeEntry {
+	const char* name;
+	PeepholeRule apply;
+	long long hits;
+};
+
+class Peephole {
+	public:
+		Peephole();
+		void run(vector<Instr>& code);
+		void report();
+		static int deadAfter(vector<Instr>& code, size_t i, int reg);
+		static size_t nextLive(vector<Instr>& code, size_t i);
+
+		static const size_t WINDOW = 8; // how far back the rules that look for an earlier instruction go
+
+		vector<PeepholeEntry> rules;
+		long long before;	// instructions in the lists it was given
+		long long after;	// and left in them, for -v
+};
+
+// 1 when nothing reads reg after code[i] before it's written again. Only the
+// code generator's scratch registers are known to be dead where straight line code ends
+int Peephole::deadAfter(vector<Instr>& code, size_t i, int reg) {
+	for (size_t j = i + 1; j < code.size(); j++) {
+		if (readsRegister(code[j], reg)) return 0;
+		if (writesRegister(code[j], reg)) return 1;
+		if (isBoundary(code[j])) return isScratch(reg);
+	}
+	return isScratch(reg); // lists end between statements
+}
+
+// Position of the next instruction after i that hasn't been removed, code.size() if there isn't one
+size_t Peephole::nextLive(vector<Instr>& code, size_t i) {
+	for (size_t j = i + 1; j < code.size(); j++) {
+		if (code[j].op != OP_NOP) return j;
+	}
+	return code.size();
+}
+
+// Replaces reads of from in instr with to, returns 1 if there were any
+int renameReads(Instr& instr, int from, int to) {
+	int renamed = 0;
+
+	switch (instr.op) {
+		case OP_MOVK:
+			return 0; // reads and writes the same operand
+		case OP_STR:
+		case OP_STP:
+		case OP_STRB:
+		case OP_STRH:
+			if (instr.rd == from) { instr.rd = to; renamed = 1; }
+			if (instr.op == OP_STP && instr.rm == from) { instr.rm = to; renamed = 1; }
+			if (instr.rn == from && instr.mode == ADDRESS_OFFSET) { instr.rn = to; renamed = 1; }
+			return renamed;
+		case OP_LDR:
+		case OP_LDP:
+		case OP_LDRB:
+		case OP_LDRH:
+			if (instr.rn == from && instr.mode == ADDRESS_OFFSET) { instr.rn = to; renamed = 1; }
+			return renamed;
+		case OP_BL:
+		case OP_SVC:
+		case OP_RET:
+			return 0;
+		default:
+			break;
+	}
+
+	if (!readsRegister(instr, from)) return 0;
+	if (instr.rn == from) { instr.rn = to; renamed = 1; }
+	if (instr.rm == from) { instr.rm = to; renamed = 1; }
+	if (instr.ra == from) { instr.ra = to; renamed = 1; }
+	return renamed;
+}
+
+// mov a, a
+int ruleSelfMove(vector<Instr>& code, size_t i) {
+	if (code[i].op != OP_MOV || code[i].rd != code[i].rn) return 0;
+	code[i].op = OP_NOP;
+	return 1;
+}
+
+// A value nothing reads: add x11, x11, x10 followed by mov x11, x9
+int ruleDeadValue(vector<Instr>& code, size_t i) {
+	if (!isPure(code[i]) || code[i].rd == REG_FP) return 0; // mov fp, sp stays for anything walking the frame chain
+	if (!Peephole::deadAfter(code, i, code[i].rd)) return 0;
+	code[i].op = OP_NOP;
+	return 1;
+}
+
+// mov x10, x9 then instructions reading x10: read x9 instead while both still hold the value, often leaving the mov dead
+int ruleForwardCopy(vector<Instr>& code, size_t i) {
+	int to = code[i].rd;
+	int from = code[i].rn;
+	if (code[i].op != OP_MOV || from == REG_SP || to == REG_SP) return 0;
+
+	int renamed = 0;
+	for (size_t j = i + 1; j < code.size(); j++) {
+		Instr& instr = code[j];
+		if (instr.op == OP_NOP) continue;
+
+		renamed |= renameReads(instr, to, from);
+		if (writesRegister(instr, to) || writesRegister(instr, from) || isBoundary(instr)) break;
+	}
+	return renamed;
+}
+
+// mov x9, #5 then mov x10, x9: put the value straight in x10
+int ruleRetarget(vector<Instr>& code, size_t i) {
+	if (!isPure(code[i]) || code[i].rd == REG_SP) return 0;
+
+	size_t next = Peephole::nextLive(code, i);
+	if (next == code.size()) return 0;
+
+	Instr& move = code[next];
+	if (move.op != OP_MOV || move.rn != code[i].rd || move.rd == REG_SP) return 0;
+	if (!Peephole::deadAfter(code, next, code[i].rd)) return 0;
+
+	code[i].rd = move.rd;
+	move.op = OP_NOP;
+	return 1;
+}
+
+// adr of a label whose address an earlier adr left in a register that hasn't changed since
+int ruleReuseAddress(vector<Instr>& code, size_t i) {
+	if (code[i].op != OP_ADR) return 0;
+
+	size_t stop = (i > Peephole::WINDOW) ? i - Peephole::WINDOW : 0;
+
+	for (size_t j = i; j-- > stop;) {
+		Instr& earlier = code[j];
+		if (isBoundary(earlier)) return 0;
+
+		if (earlier.op == OP_ADR && earlier.label == code[i].label) {
+			for (size_t k = j + 1; k < i; k++) { // the address has to still be there
+				if (writesRegister(code[k], earlier.rd)) return 0;
+			}
+
+			code[i] = makeInstr(OP_MOV, code[i].rd, earlier.rd);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// A load from where the last store went, with neither register changed since: use the stored value
+int ruleStoreReload(vector<Instr>& code, size_t i) {
+	if (code[i].op != OP_LDR || code[i].mode != ADDRESS_OFFSET) return 0;
+
+	size_t stop = (i > Peephole::WINDOW) ? i - Peephole::WINDOW : 0;
+
+	for (size_t j = i; j-- > stop;) {
+		Instr& earlier = code[j];
+		if (isBoundary(earlier)) return 0;
+		if (earlier.op == OP_STP || earlier.op == OP_STRB || earlier.op == OP_STRH) return 0; // could have written anywhere close
+
+		if (earlier.op == OP_STR) {
+			if (earlier.mode != ADDRESS_OFFSET || earlier.rn != code[i].rn || earlier.imm != code[i].imm) return 0; // any other store might overlap
+
+			for (size_t k = j + 1; k < i; k++) {
+				if (writesRegister(code[k], earlier.rd) || writesRegister(code[k], earlier.rn)) return 0;
+			}
+
+			code[i] = makeInstr(OP_MOV, code[i].rd, earlier.rd);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// b to a label that comes straight after it
+int ruleBranchToNext(vector<Instr>& code, size_t i) {
+	if (code[i].op != OP_B) return 0;
+
+	for (size_t j = i + 1; j < code.size() && (code[j].op == OP_LABEL || code[j].op == OP_NOP); j++) {
+		if (code[j].op == OP_LABEL && code[j].label == code[i].label) {
+			code[i].op = OP_NOP;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+Peephole::Peephole() {
+	rules = {
+		{"self-move", ruleSelfMove, 0},
+		{"forward-copy", ruleForwardCopy, 0},
+		{"retarget", ruleRetarget, 0},
+		{"reuse-address", ruleReuseAddress, 0},
+		{"store-reload", ruleStoreReload, 0},
+		{"dead-value", ruleDeadValue, 0},
+		{"branch-to-next", ruleBranchToNext, 0}
+	};
+	before = 0;
+	after = 0;
+}
+
+void Peephole::run(vector<Instr>& code) {
+	int changed = 1;
+	before += code.size();
+
+	while (changed) {
+		changed = 0;
+
+		for (size_t i = 0; i < code.size(); i++) {
+			int applied = 1;
+
+			while (applied && code[i].op != OP_NOP) { // a rewrite often lets another rule apply at the same place
+				applied = 0;
+
+				for (PeepholeEntry& rule : rules) {
+					if (rule.apply(code, i)) {
+						rule.hits++;
+						applied = changed = 1;
+						break;
+					}
+				}
+			}
+		}
+
+		size_t kept = 0; // drop what the rules removed, so the next round doesn't step over it
+		for (size_t i = 0; i < code.size(); i++) {
+			if (code[i].op != OP_NOP) code[kept++] = code[i];
+		}
+		code.resize(kept);
+	}
+	after += code.size();
+}
+
+// Hit counts for -v
+void Peephole::report() {
+	for (PeepholeEntry& rule : rules) {
+		TRACE(TRACE_STATUS, "peephole " << rule.name << ": " << rule.hits << endl);
+	}
+	TRACE(TRACE_STATUS, "peephole: " << before << " instructions in, " << after << " out" << endl);
+}
+
+#endif
@@ -0,0 +1,360 @@
+#include <vector>
+#include <algorithm>
+
+#include "ir.h"
+
+#ifndef REGALLOC_H
+#define REGALLOC_H
+using namespace std;
+
+const int FIRST_SAVED_REGISTER = 19;	// x19 - x28 are callee-saved
+const int SAVED_REGISTERS = 10;
+
+// Loop registers :
+/*
+	The variables one loop keeps in registers, symbols[i] lives in x(19 + i).
+	Globals are listed by symbol id and the locals of the function the loop is
+	in by firstLocal + slot. written marks the ones the loop assigns, which are
+	the only ones that ever need storing back.
+*/
+class LoopRegisters {
+	public:
+		LoopRegisters() {
+			firstLocal = 0;
+		}
+
+		int find(int symbol) const { // register of symbol, -1 if it stays in memory
+			for (int i = 0; i < (int) symbols.size(); i++) {
+				if (symbols[i] == symbol) return FIRST_SAVED_REGISTER + i;
+			}
+			return -1;
+		}
+
+		int findLocal(int slot) const {
+			return find(firstLocal + slot);
+		}
+
+		int isLocal(int i) const {
+			if (symbols[i] >= firstLocal) return 1;
+			else return 0;
+		}
+
+		int empty() const {
+			if (symbols.empty()) return 1;
+			else return 0;
+		}
+
+		vector<int> symbols;
+		vector<char> written;
+		int firstLocal;
+};
+
+const int FIRST_TEMPORARY = 9;	// x9 - x15 hold values while an expression is worked out
+const int TEMPORARIES = 7;
+
+// Temporary registers :
+/*
+	The pool expressions take their intermediate values from. A register is
+	taken for each value and given back once whatever reads it has been
+	emitted, so nothing is left taken between statements. Loop registers and
+	anything else outside the pool can be given back without effect, so
+	callers don't need to know where a value ended up.
+*/
+class TemporaryRegisters {
+	public:
+		TemporaryRegisters() {
+			free = (1 << TEMPORARIES) - 1;
+		}
+
+		int take() { // lowest free register, -1 when they're all taken
+			if (free == 0) return -1;
+
+			int i = __builtin_ctz(free);
+			free &= ~(1 << i);
+			return FIRST_TEMPORARY + i;
+		}
+
+		void release(int reg) {
+			if (owns(reg)) free |= 1 << (reg - FIRST_TEMPORARY);
+		}
+
+		int owns(int reg) const {
+			if (reg >= FIRST_TEMPORARY && reg < FIRST_TEMPORARY + TEMPORARIES) return 1;
+			else return 0;
+		}
+
+		int available() const {
+			return __builtin_popcount(free);
+		}
+
+		unsigned free;	// bit i set when x(9 + i) can be taken
+};
+
+// Function effects :
+/*
+	The globals a call can read or write, including through the functions it
+	calls in turn. A function containing a GOTO can leave from anywhere, so
+	it counts as touching everything.
+*/
+struct FunctionEffects {
+	int body;
+	int done;
+	int jumps;
+	vector<int> reads;	// sorted symbol ids
+	vector<int> writes;
+};
+
+// Register allocator :
+/*
+	Picks the INT variables (globals, or locals of the function the loop is
+	in) used most inside each outermost WHILE loop, with
+	uses in nested loops counting for more, and gives them x19 - x28 for the
+	whole loop. The code generator loads them before the loop and stores the
+	written ones after it; in between memory is only brought up to date where
+	something else reads it: calls to functions using the variable, GOTOs and
+	LABELs, which a GOTO can reach with only memory up to date.
+*/
+class RegisterAllocator {
+	public:
+		RegisterAllocator(IrProgram& inputIr);
+		LoopRegisters allocate(int loop, int function);
+		int loopRegisters(int id, int function);
+		int reads(int function, int symbol);
+		int writes(int function, int symbol);
+		FunctionEffects& effects(int function);
+
+		void countBlock(int id, long long weight);
+		void countExpression(int id, long long weight);
+		void countUse(int symbol, long long weight);
+		void collectBlock(int id, FunctionEffects& into, int self);
+		void collectExpression(int id, FunctionEffects& into);
+		static void addSorted(vector<int>& into, int symbol);
+		static void merge(vector<int>& into, const vector<int>& from);
+
+		IrProgram& ir;
+		int firstLocal;		// where the locals of the loop being allocated start in uses
+		vector<long long> uses;	// weighted uses of each symbol in the loop being allocated
+		vector<char> assigned;	// 1 for symbols the loop being allocated assigns
+		vector<int> used;	// symbols with uses, so both can be cleared again
+		vector<FunctionEffects> functionEffects; // indexed by function id
+};
+
+RegisterAllocator::RegisterAllocator(IrProgram& inputIr) : ir(inputIr) {
+}
+
+// Chooses the registers for a WHILE node in function (-1 for none), the result is empty when it uses no INT variables
+LoopRegisters RegisterAllocator::allocate(int loop, int function) {
+	LoopRegisters registers;
+	int locals = (function == -1) ? 0 : ir.functionMap.scopes[function].locals.size();
+
+	firstLocal = ir.symbolMap.size();
+	registers.firstLocal = firstLocal;
+	uses.resize(max(uses.size(), (size_t) (firstLocal + locals)), 0);
+	assigned.resize(uses.size(), 0);
+
+	countExpression(ir.node(loop).a, 1);
+	countBlock(ir.node(loop).b, 1);
+
+	sort(used.begin(), used.end(), [&](int x, int y) {
+		if (uses[x] != uses[y]) return uses[x] > uses[y];
+		return x < y;
+	});
+
+	for (int symbol : used) {
+		int isInt;
+		if (symbol < firstLocal) isInt = ir.symbolMap.isInt(symbol);
+		else isInt = (ir.functionMap.scopes[function].localTypes[symbol - firstLocal] == TOKEN_TYPE::INT);
+
+		if ((int) registers.symbols.size() < SAVED_REGISTERS && isInt) {
+			registers.symbols.push_back(symbol);
+			registers.written.push_back(assigned[symbol]);
+		}
+		uses[symbol] = 0;
+		assigned[symbol] = 0;
+	}
+	used.clear();
+
+	return registers;
+}
+
+void RegisterAllocator::countUse(int symbol, long long weight) {
+	if (uses[symbol] == 0) used.push_back(symbol);
+	uses[symbol] += weight;
+}
+
+// Adds up the uses in a block and marks what it assigns
+void RegisterAllocator::countBlock(int id, long long weight) {
+	for (; id != -1; id = ir.node(id).next) {
+		IrNode& node = ir.node(id);
+
+		switch (node.op) {
+			case IR_IF:
+				countExpression(node.a, weight);
+				countBlock(node.b, weight);
+				countBlock(node.c, weight);
+				break;
+			case IR_WHILE: {
+				long long inner = min(weight * 8, 1LL << 40); // a nested loop runs its body many times per outer iteration
+				countExpression(node.a, inner);
+				countBlock(node.b, inner);
+				break;
+			}
+			case IR_ASSIGN:
+				countExpression(node.b, weight);
+				countUse(node.a, weight);
+				assigned[node.a] = 1;
+				break;
+			case IR_ASSIGN_LOCAL:
+				countExpression(node.b, weight);
+				countUse(firstLocal + node.a, weight);
+				assigned[firstLocal + node.a] = 1;
+				break;
+			case IR_CALL:
+				for (int arg = node.b; arg != -1; arg = ir.node(arg).next) {
+					countExpression(arg, weight);
+				}
+				break;
+			case IR_PRINT_VALUE:
+				countExpression(node.a, weight);
+				break;
+			default:
+				break;
+		}
+	}
+}
+
+void RegisterAllocator::countExpression(int id, long long weight) {
+	IrNode& node = ir.node(id);
+
+	if (node.op == IR_VAR) {
+		countUse(node.a, weight);
+	} else if (node.op == IR_LOCAL) {
+		countUse(firstLocal + node.a, weight);
+	} else if (node.op != IR_NUMBER && node.op != IR_PARAM) {
+		countExpression(node.a, weight);
+		if (node.b != -1) countExpression(node.b, weight);
+	}
+}
+
+// Most registers any outermost loop in a block takes, so a function body's prologue can save them
+int RegisterAllocator::loopRegisters(int id, int function) {
+	int most = 0;
+
+	for (; id != -1; id = ir.node(id).next) {
+		IrNode& node = ir.node(id);
+
+		if (node.op == IR_WHILE) {
+			most = max(most, (int) allocate(id, function).symbols.size());
+		} else if (node.op == IR_IF) {
+			most = max(most, loopRegisters(node.b, function));
+			most = max(most, loopRegisters(node.c, function));
+		}
+	}
+
+	return most;
+}
+
+// 1 when calling function can read symbol
+int RegisterAllocator::reads(int function, int symbol) {
+	FunctionEffects& found = effects(function);
+	if (found.jumps || binary_search(found.reads.begin(), found.reads.end(), symbol)) return 1;
+	else return 0;
+}
+
+// 1 when calling function can change symbol
+int RegisterAllocator::writes(int function, int symbol) {
+	FunctionEffects& found = effects(function);
+	if (found.jumps || binary_search(found.writes.begin(), found.writes.end(), symbol)) return 1;
+	else return 0;
+}
+
+// Effects of a function, worked out the first time they're asked for. A function
+// can only call itself and functions defined before it, so this always finishes
+FunctionEffects& RegisterAllocator::effects(int function) {
+	if (functionEffects.empty()) {
+		functionEffects.resize(ir.functionMap.scopes.size(), {-1, 0, 0, {}, {}});
+
+		for (IrNode& node : ir.nodes) {
+			if (node.op == IR_FUNC) functionEffects[node.a].body = node.b;
+		}
+	}
+
+	FunctionEffects& found = functionEffects[function];
+
+	if (!found.done) {
+		found.done = 1;
+		collectBlock(found.body, found, function);
+	}
+
+	return found;
+}
+
+void RegisterAllocator::collectBlock(int id, FunctionEffects& into, int self) {
+	for (; id != -1; id = ir.node(id).next) {
+		IrNode& node = ir.node(id);
+
+		switch (node.op) {
+			case IR_IF:
+				collectExpression(node.a, into);
+				collectBlock(node.b, into, self);
+				collectBlock(node.c, into, self);
+				break;
+			case IR_WHILE:
+				collectExpression(node.a, into);
+				collectBlock(node.b, into, self);
+				break;
+			case IR_GOTO:
+				into.jumps = 1;
+				break;
+			case IR_ASSIGN:
+				collectExpression(node.b, into);
+				addSorted(into.writes, node.a);
+				break;
+			case IR_ASSIGN_LOCAL: // nobody else sees a local
+				collectExpression(node.b, into);
+				break;
+			case IR_PRINT_VALUE:
+				collectExpression(node.a, into);
+				break;
+			case IR_CALL: {
+				for (int arg = node.b; arg != -1; arg = ir.node(arg).next) {
+					collectExpression(arg, into);
+				}
+
+				if (node.a == self) break; // recursion adds nothing new
+
+				FunctionEffects& callee = effects(node.a);
+				into.jumps |= callee.jumps;
+				merge(into.reads, callee.reads);
+				merge(into.writes, callee.writes);
+				break;
+			}
+			default:
+				break;
+		}
+	}
+}
+
+void RegisterAllocator::collectExpression(int id, FunctionEffects& into) {
+	IrNode& node = ir.node(id);
+
+	if (node.op == IR_VAR) {
+		addSorted(into.reads, node.a);
+	} else if (node.op != IR_NUMBER && node.op != IR_PARAM && node.op != IR_LOCAL) {
+		collectExpression(node.a, into);
+		if (node.b != -1) collectExpression(node.b, into);
+	}
+}
+
+void RegisterAllocator::addSorted(vector<int>& into, int symbol) {
+	auto at = lower_bound(into.begin(), into.end(), symbol);
+	if (at == into.end() || *at != symbol) into.insert(at, symbol);
+}
+
+void RegisterAllocator::merge(vector<int>& into, const vector<int>& from) {
+	vector<int> both;
+	set_union(into.begin(), into.end(), from.begin(), from.end(), back_inserter(both));
+	into.swap(both);
+}
+
+#endif
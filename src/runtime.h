@@ -0,0 +1,276 @@
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "instr.h"
+#include "nametable.h"
+#include "emitter.h"
+#include "immediate.h"
+
+#ifndef RUNTIME_H
+#define RUNTIME_H
+using namespace std;
+
+const int OUTPUT_SIZE = 4096; // bytes of output held before they're written
+const int NUMBER_SIZE = 24; // room for the digits of any 64 bit number, its sign and the 0 after it
+
+// Runtime :
+/*
+	Small routines the generated code calls, written out as Instrs after the
+	functions, and only when something calls them. PRINT goes through
+	RPRINT, which copies the text into an OUTPUT buffer in .bss instead of
+	making a write system call for every PRINT. The buffer is written out
+	when it fills up and by RFLUSH before the program exits. The first
+	RPRINT asks the kernel whether stdout is a terminal (the TCGETS ioctl
+	only works on one), and on a terminal every PRINT is written out straight
+	away, so nothing sits in the buffer while someone is watching. The
+	routines only use x0 - x8, which nothing keeps anything in between
+	statements, and never touch x19 - x28.
+
+	PRINT of an expression goes through RPRINT_NUMBER, which writes the
+	value's digits from the back into NUMBER_TEXT and passes them on to
+	RPRINT. It takes two digits at a time: the quotient by 100 comes from
+	a multiply by a reciprocal and the remainder indexes a table of the
+	pairs "00" - "99", so a 19 digit number takes 10 steps and no divides.
+*/
+class Runtime {
+	public:
+		Runtime(NameTable& labelTable);
+		int call(string_view routine);
+		void generate(vector<Instr>& out);
+		void data(Emitter& emitter);
+		void print(vector<Instr>& out);
+		void flush(vector<Instr>& out);
+		void printNumber(vector<Instr>& out);
+		void write(vector<Instr>& out, int from);
+		void add(vector<Instr>& out, const Instr& instr);
+		void branch(vector<Instr>& out, OPCODE op, int reg, int label);
+		static Instr conditional(Instr instr, CONDITION cond);
+
+		NameTable& labels;
+		int used;	// something calls the routines, so they and the buffer are written out
+		int numbers;	// something calls RPRINT_NUMBER
+};
+
+Runtime::Runtime(NameTable& labelTable) : labels(labelTable) {
+	used = 0;
+	numbers = 0;
+}
+
+// Label of a routine for a bl, which makes sure the routines are written out
+int Runtime::call(string_view routine) {
+	used = 1;
+	if (routine == "RPRINT_NUMBER") numbers = 1;
+	return labels.insert(routine);
+}
+
+void Runtime::add(vector<Instr>& out, const Instr& instr) {
+	out.push_back(instr);
+}
+
+// cbz or cbnz
+void Runtime::branch(vector<Instr>& out, OPCODE op, int reg, int label) {
+	Instr instr = makeLabelInstr(op, label);
+	instr.rn = reg;
+	out.push_back(instr);
+}
+
+Instr Runtime::conditional(Instr instr, CONDITION cond) { // b.cond, csel and csinc
+	instr.cond = cond;
+	return instr;
+}
+
+// Appends every routine something called
+void Runtime::generate(vector<Instr>& out) {
+	if (!used) return;
+
+	print(out);
+	flush(out);
+	if (numbers) printNumber(out);
+}
+
+void Runtime::data(Emitter& emitter) {
+	if (!used) return;
+
+	emitter.reserve("OUTPUT_STATE", 16, 16); // bytes in the buffer, then 1 for a terminal, 2 for anything else, 0 before the first PRINT
+	emitter.reserve("OUTPUT", OUTPUT_SIZE);
+
+	if (!numbers) return;
+
+	string pairs;
+	for (int i = 0; i < 100; i++) {
+		pairs += (char) ('0' + i / 10);
+		pairs += (char) ('0' + i % 10);
+	}
+	emitter.ascii("DIGITS", pairs, 0);
+	emitter.reserve("NUMBER_TEXT", NUMBER_SIZE);
+}
+
+// write(1, from, x2), leaving register from as it was
+void Runtime::write(vector<Instr>& out, int from) {
+	add(out, makeInstr(OP_MOVZ, 0, -1, -1, 1));
+	add(out, makeInstr(OP_MOV, 1, from));
+	add(out, makeInstr(OP_MOVZ, 8, -1, -1, 64));
+	add(out, makeInstr(OP_SVC, -1, -1, -1, 0));
+}
+
+// RPRINT: x1 = text, x2 = its length
+void Runtime::print(vector<Instr>& out) {
+	int known = labels.insert("RPRINT_KNOWN");
+	int copy = labels.insert("RPRINT_COPY");
+	int words = labels.insert("RPRINT_WORDS");
+	int bytes = labels.insert("RPRINT_BYTES");
+	int copied = labels.insert("RPRINT_COPIED");
+	int done = labels.insert("RPRINT_DONE");
+
+	add(out, makeLabelInstr(OP_LABEL, labels.insert("RPRINT")));
+	add(out, makeLabelInstr(OP_ADR, labels.insert("OUTPUT_STATE"), 3));
+	add(out, makeLabelInstr(OP_ADR, labels.insert("OUTPUT"), 5));
+
+	// first PRINT: TCGETS into the empty buffer, which only succeeds on a terminal
+	add(out, makeMemoryInstr(OP_LDR, 4, 3, 8));
+	branch(out, OP_CBNZ, 4, known);
+	add(out, makeInstr(OP_MOV, 6, 1));
+	add(out, makeInstr(OP_MOV, 7, 2));
+	add(out, makeInstr(OP_MOVZ, 0, -1, -1, 1));
+	add(out, makeInstr(OP_MOVZ, 1, -1, -1, 0x5401));
+	add(out, makeInstr(OP_MOV, 2, 5));
+	add(out, makeInstr(OP_MOVZ, 8, -1, -1, 29));
+	add(out, makeInstr(OP_SVC, -1, -1, -1, 0));
+	add(out, makeInstr(OP_MOVZ, 4, -1, -1, 1));
+	add(out, makeInstr(OP_CMP_IMM, -1, 0, -1, 0));
+	add(out, conditional(makeInstr(OP_CSINC, 4, 4, 4), COND_EQ));
+	add(out, makeMemoryInstr(OP_STR, 4, 3, 8));
+	add(out, makeInstr(OP_MOV, 1, 6));
+	add(out, makeInstr(OP_MOV, 2, 7));
+	add(out, makeLabelInstr(OP_LABEL, known));
+
+	add(out, makeMemoryInstr(OP_LDR, 4, 3, 0)); // x4 = next free byte, x6 = end of the buffer
+	add(out, makeInstr(OP_ADD, 4, 5, 4));
+	add(out, makeInstr(OP_ADD_IMM, 6, 5, -1, OUTPUT_SIZE));
+
+	// as much as fits, x0 bytes, 8 at a time while it can
+	add(out, makeLabelInstr(OP_LABEL, copy));
+	add(out, makeInstr(OP_SUB, 0, 6, 4));
+	add(out, makeInstr(OP_CMP, -1, 2, 0));
+	add(out, conditional(makeInstr(OP_CSEL, 0, 2, 0), COND_LO));
+	add(out, makeInstr(OP_SUB, 2, 2, 0));
+	add(out, makeLabelInstr(OP_LABEL, words));
+	add(out, makeInstr(OP_CMP_IMM, -1, 0, -1, 8));
+	add(out, conditional(makeLabelInstr(OP_BCOND, bytes), COND_LO));
+	add(out, makeMemoryInstr(OP_LDR, 7, 1, 8, ADDRESS_POST));
+	add(out, makeMemoryInstr(OP_STR, 7, 4, 8, ADDRESS_POST));
+	add(out, makeInstr(OP_SUB_IMM, 0, 0, -1, 8));
+	add(out, makeLabelInstr(OP_B, words));
+	add(out, makeLabelInstr(OP_LABEL, bytes));
+	branch(out, OP_CBZ, 0, copied);
+	add(out, makeMemoryInstr(OP_LDRB, 7, 1, 1, ADDRESS_POST));
+	add(out, makeMemoryInstr(OP_STRB, 7, 4, 1, ADDRESS_POST));
+	add(out, makeInstr(OP_SUB_IMM, 0, 0, -1, 1));
+	add(out, makeLabelInstr(OP_B, bytes));
+	add(out, makeLabelInstr(OP_LABEL, copied));
+
+	// the rest didn't fit: write the full buffer out and start it again
+	branch(out, OP_CBZ, 2, done);
+	add(out, makeInstr(OP_MOV, 6, 1));
+	add(out, makeInstr(OP_MOV, 7, 2));
+	add(out, makeInstr(OP_SUB, 2, 4, 5));
+	write(out, 5);
+	add(out, makeInstr(OP_MOV, 1, 6));
+	add(out, makeInstr(OP_MOV, 2, 7));
+	add(out, makeInstr(OP_MOV, 4, 5));
+	add(out, makeInstr(OP_ADD_IMM, 6, 5, -1, OUTPUT_SIZE));
+	add(out, makeLabelInstr(OP_B, copy));
+
+	add(out, makeLabelInstr(OP_LABEL, done));
+	add(out, makeInstr(OP_SUB, 4, 4, 5));
+	add(out, makeMemoryInstr(OP_STR, 4, 3, 0));
+	add(out, makeMemoryInstr(OP_LDR, 4, 3, 8));
+	add(out, makeInstr(OP_CMP_IMM, -1, 4, -1, 1));
+	add(out, conditional(makeLabelInstr(OP_BCOND, labels.insert("RFLUSH")), COND_EQ)); // RFLUSH returns for it
+	add(out, makeInstr(OP_RET));
+}
+
+// RFLUSH: writes out whatever is in the buffer
+void Runtime::flush(vector<Instr>& out) {
+	int done = labels.insert("RFLUSH_DONE");
+
+	add(out, makeLabelInstr(OP_LABEL, labels.insert("RFLUSH")));
+	add(out, makeLabelInstr(OP_ADR, labels.insert("OUTPUT_STATE"), 3));
+	add(out, makeMemoryInstr(OP_LDR, 2, 3, 0));
+	branch(out, OP_CBZ, 2, done);
+	add(out, makeLabelInstr(OP_ADR, labels.insert("OUTPUT"), 5));
+	write(out, 5);
+	add(out, makeMemoryInstr(OP_STR, REG_XZR, 3, 0));
+	add(out, makeLabelInstr(OP_LABEL, done));
+	add(out, makeInstr(OP_RET));
+}
+
+// RPRINT_NUMBER: x0 = value
+void Runtime::printNumber(vector<Instr>& out) {
+	int pairs = labels.insert("RPRINT_NUMBER_PAIRS");
+	int last = labels.insert("RPRINT_NUMBER_LAST");
+	int one = labels.insert("RPRINT_NUMBER_ONE");
+	int sign = labels.insert("RPRINT_NUMBER_SIGN");
+	int done = labels.insert("RPRINT_NUMBER_DONE");
+
+	add(out, makeLabelInstr(OP_LABEL, labels.insert("RPRINT_NUMBER")));
+	add(out, makeLabelInstr(OP_ADR, labels.insert("NUMBER_TEXT"), 1)); // x1 = first digit so far
+	add(out, makeInstr(OP_ADD_IMM, 1, 1, -1, NUMBER_SIZE - 1));
+	add(out, makeMemoryInstr(OP_STRB, REG_XZR, 1, 0));
+	add(out, makeInstr(OP_NEG, 2, -1, 0)); // x2 = what's left to print, the value without its sign
+	add(out, makeInstr(OP_CMP_IMM, -1, 0, -1, 0));
+	add(out, conditional(makeInstr(OP_CSEL, 2, 2, 0), COND_LT));
+	add(out, makeLabelInstr(OP_ADR, labels.insert("DIGITS"), 3));
+
+	// x / 100 is (x / 4) / 25, and with x / 4 below 2^62 ceil(2^66 / 25) is exact enough for it
+	vector<Instr> reciprocal;
+	immediateInstrs(4, (unsigned long long) (((unsigned __int128) 1 << 66) / 25 + 1), reciprocal);
+	for (const Instr& instr : reciprocal) add(out, instr);
+	add(out, makeInstr(OP_MOVZ, 5, -1, -1, 100));
+	add(out, makeInstr(OP_CMP_IMM, -1, 2, -1, 100));
+	add(out, conditional(makeLabelInstr(OP_BCOND, last), COND_LO));
+
+	add(out, makeLabelInstr(OP_LABEL, pairs)); // the lowest two digits, while there are more than two
+	add(out, makeInstr(OP_LSR_IMM, 6, 2, -1, 2));
+	add(out, makeInstr(OP_UMULH, 6, 6, 4));
+	add(out, makeInstr(OP_LSR_IMM, 6, 6, -1, 2));
+	Instr remainder = makeInstr(OP_MSUB, 7, 6, 5);
+	remainder.ra = 2;
+	add(out, remainder);
+	add(out, makeInstr(OP_LSL_IMM, 7, 7, -1, 1));
+	add(out, makeInstr(OP_ADD, 7, 3, 7));
+	add(out, makeMemoryInstr(OP_LDRH, 7, 7, 0));
+	add(out, makeMemoryInstr(OP_STRH, 7, 1, -2, ADDRESS_PRE));
+	add(out, makeInstr(OP_MOV, 2, 6));
+	add(out, makeInstr(OP_CMP_IMM, -1, 2, -1, 100));
+	add(out, conditional(makeLabelInstr(OP_BCOND, pairs), COND_HS));
+
+	add(out, makeLabelInstr(OP_LABEL, last)); // one or two digits left
+	add(out, makeInstr(OP_CMP_IMM, -1, 2, -1, 10));
+	add(out, conditional(makeLabelInstr(OP_BCOND, one), COND_LO));
+	add(out, makeInstr(OP_LSL_IMM, 7, 2, -1, 1));
+	add(out, makeInstr(OP_ADD, 7, 3, 7));
+	add(out, makeMemoryInstr(OP_LDRH, 7, 7, 0));
+	add(out, makeMemoryInstr(OP_STRH, 7, 1, -2, ADDRESS_PRE));
+	add(out, makeLabelInstr(OP_B, sign));
+	add(out, makeLabelInstr(OP_LABEL, one));
+	add(out, makeInstr(OP_ADD_IMM, 7, 2, -1, '0'));
+	add(out, makeMemoryInstr(OP_STRB, 7, 1, -1, ADDRESS_PRE));
+
+	add(out, makeLabelInstr(OP_LABEL, sign));
+	Instr positive = makeLabelInstr(OP_TBZ, done);
+	positive.rn = 0;
+	positive.imm = 63;
+	add(out, positive);
+	add(out, makeInstr(OP_MOVZ, 7, -1, -1, '-'));
+	add(out, makeMemoryInstr(OP_STRB, 7, 1, -1, ADDRESS_PRE));
+
+	add(out, makeLabelInstr(OP_LABEL, done)); // x2 = bytes from the first digit to the end of NUMBER_TEXT
+	add(out, makeLabelInstr(OP_ADR, labels.insert("NUMBER_TEXT"), 2));
+	add(out, makeInstr(OP_ADD_IMM, 2, 2, -1, NUMBER_SIZE));
+	add(out, makeInstr(OP_SUB, 2, 2, 1));
+	add(out, makeLabelInstr(OP_B, labels.insert("RPRINT"))); // RPRINT returns for it
+}
+
+#endif
@@ -0,0 +1,174 @@
+#include <cstddef>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+#ifndef SCAN_H
+#define SCAN_H
+using namespace std;
+
+// Scanning kernels :
+/*
+	The lexer uses these to jump over whitespace, comments and string literals
+	instead of stepping one character at a time. Each kernel looks at n bytes
+	from p and returns the offset of the first byte it stops on, or n when there
+	is none. The widest version the CPU supports is picked once at startup, and
+	every version returns the same offsets as the scalar one.
+*/
+struct ScanKernels {
+	size_t (*skipBlanks)(const char* p, size_t n);		// first byte that isn't ' ', '\t' or '\r'
+	size_t (*findNewline)(const char* p, size_t n);		// first '\n'
+	size_t (*findStringEnd)(const char* p, size_t n);	// first '"', or a character strings can't contain
+	const char* name;
+};
+
+inline int isBlank(char c) {
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline int isStringEnd(char c) {
+	return c == '\"' || c == '\n' || c == '\t' || c == '\r';
+}
+
+size_t skipBlanksScalar(const char* p, size_t n) {
+	size_t i = 0;
+	while (i < n && isBlank(p[i])) i++;
+	return i;
+}
+
+size_t findNewlineScalar(const char* p, size_t n) {
+	size_t i = 0;
+	while (i < n && p[i] != '\n') i++;
+	return i;
+}
+
+size_t findStringEndScalar(const char* p, size_t n) {
+	size_t i = 0;
+	while (i < n && !isStringEnd(p[i])) i++;
+	return i;
+}
+
+#ifdef SCAN_X86
+// SSE2 is part of x86-64, so these are always available there. 16 bytes per step
+__attribute__((target("sse2")))
+size_t skipBlanksSSE2(const char* p, size_t n) {
+	const __m128i space = _mm_set1_epi8(' ');
+	const __m128i tab = _mm_set1_epi8('\t');
+	const __m128i cr = _mm_set1_epi8('\r');
+
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i*) (p + i));
+		__m128i blank = _mm_or_si128(_mm_cmpeq_epi8(chunk, space), _mm_or_si128(_mm_cmpeq_epi8(chunk, tab), _mm_cmpeq_epi8(chunk, cr)));
+
+		unsigned mask = ~_mm_movemask_epi8(blank) & 0xFFFF;
+		if (mask) return i + __builtin_ctz(mask);
+	}
+
+	return i + skipBlanksScalar(p + i, n - i);
+}
+
+__attribute__((target("sse2")))
+size_t findNewlineSSE2(const char* p, size_t n) {
+	const __m128i newline = _mm_set1_epi8('\n');
+
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i*) (p + i));
+
+		unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline));
+		if (mask) return i + __builtin_ctz(mask);
+	}
+
+	return i + findNewlineScalar(p + i, n - i);
+}
+
+__attribute__((target("sse2")))
+size_t findStringEndSSE2(const char* p, size_t n) {
+	const __m128i quote = _mm_set1_epi8('\"');
+	const __m128i newline = _mm_set1_epi8('\n');
+	const __m128i tab = _mm_set1_epi8('\t');
+	const __m128i cr = _mm_set1_epi8('\r');
+
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i*) (p + i));
+		__m128i end = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, newline)),
+					   _mm_or_si128(_mm_cmpeq_epi8(chunk, tab), _mm_cmpeq_epi8(chunk, cr)));
+
+		unsigned mask = _mm_movemask_epi8(end);
+		if (mask) return i + __builtin_ctz(mask);
+	}
+
+	return i + findStringEndScalar(p + i, n - i);
+}
+
+// AVX2 versions, 32 bytes per step. Only used when the CPU reports AVX2
+__attribute__((target("avx2")))
+size_t skipBlanksAVX2(const char* p, size_t n) {
+	const __m256i space = _mm256_set1_epi8(' ');
+	const __m256i tab = _mm256_set1_epi8('\t');
+	const __m256i cr = _mm256_set1_epi8('\r');
+
+	size_t i = 0;
+	for (; i + 32 <= n; i += 32) {
+		__m256i chunk = _mm256_loadu_si256((const __m256i*) (p + i));
+		__m256i blank = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, space), _mm256_or_si256(_mm256_cmpeq_epi8(chunk, tab), _mm256_cmpeq_epi8(chunk, cr)));
+
+		unsigned mask = ~(unsigned) _mm256_movemask_epi8(blank);
+		if (mask) return i + __builtin_ctz(mask);
+	}
+
+	return i + skipBlanksSSE2(p + i, n - i);
+}
+
+__attribute__((target("avx2")))
+size_t findNewlineAVX2(const char* p, size_t n) {
+	const __m256i newline = _mm256_set1_epi8('\n');
+
+	size_t i = 0;
+	for (; i + 32 <= n; i += 32) {
+		__m256i chunk = _mm256_loadu_si256((const __m256i*) (p + i));
+
+		unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, newline));
+		if (mask) return i + __builtin_ctz(mask);
+	}
+
+	return i + findNewlineSSE2(p + i, n - i);
+}
+
+__attribute__((target("avx2")))
+size_t findStringEndAVX2(const char* p, size_t n) {
+	const __m256i quote = _mm256_set1_epi8('\"');
+	const __m256i newline = _mm256_set1_epi8('\n');
+	const __m256i tab = _mm256_set1_epi8('\t');
+	const __m256i cr = _mm256_set1_epi8('\r');
+
+	size_t i = 0;
+	for (; i + 32 <= n; i += 32) {
+		__m256i chunk = _mm256_loadu_si256((const __m256i*) (p + i));
+		__m256i end = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote), _mm256_cmpeq_epi8(chunk, newline)),
+					      _mm256_or_si256(_mm256_cmpeq_epi8(chunk, tab), _mm256_cmpeq_epi8(chunk, cr)));
+
+		unsigned mask = _mm256_movemask_epi8(end);
+		if (mask) return i + __builtin_ctz(mask);
+	}
+
+	return i + findStringEndSSE2(p + i, n - i);
+}
+#endif
+
+ScanKernels selectScanKernels() {
+#ifdef SCAN_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return {skipBlanksAVX2, findNewlineAVX2, findStringEndAVX2, "avx2"};
+	if (__builtin_cpu_supports("sse2")) return {skipBlanksSSE2, findNewlineSSE2, findStringEndSSE2, "sse2"};
+#endif
+	return {skipBlanksScalar, findNewlineScalar, findStringEndScalar, "scalar"};
+}
+
+ScanKernels SCAN = selectScanKernels();
+
+#endif
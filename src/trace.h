@@ -0,0 +1,28 @@
+#include <iostream>
+
+#ifndef TRACE_H
+#define TRACE_H
+using namespace std;
+
+// Trace output :
+/*
+	Nothing but diagnostics is printed by default. -v turns on status messages
+	and --trace prints every parser production as it runs. The message is only
+	built when its level is enabled, and compiling with -DSIMPLE_NO_TRACE takes
+	the trace calls out of the compiler entirely.
+*/
+enum TRACE_LEVEL : int {
+	TRACE_QUIET = 0,
+	TRACE_STATUS,	// -v
+	TRACE_PARSER	// --trace
+};
+
+int traceLevel = TRACE_QUIET;
+
+#ifdef SIMPLE_NO_TRACE
+#define TRACE(level, message) do {} while (0)
+#else
+#define TRACE(level, message) do { if (traceLevel >= (level)) cout << message; } while (0)
+#endif
+
+#endif
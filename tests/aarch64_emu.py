@@ -0,0 +1,383 @@
+#!/usr/bin/env python3
+# Runs the assembly the compiler writes, for testing on hosts that aren't AArch64
+# and have no qemu-aarch64. It knows the instructions and directives the code
+# generator uses and the write, ioctl and exit system calls.
+# usage: aarch64_emu.py file.s [maxsteps]
+# The program's output goes to stdout and its exit status is the emulator's.
+import sys, re, os
+
+M64 = (1 << 64) - 1
+def s64(v):
+    v &= M64
+    return v - (1 << 64) if v >> 63 else v
+
+class Emu:
+    def __init__(self, text):
+        self.instrs = []      # (op, args, lineno)
+        self.labels = {}      # name -> ('t', idx) or ('d', addr)
+        self.consts = {}
+        self.mem = bytearray()
+        self.DBASE = 0x100000
+        self.TBASE = 0x1000
+        self.parse(text)
+
+    def parse(self, text):
+        section = 'text'
+        pending = []
+        lines = text.split('\n')
+        for ln, raw in enumerate(lines):
+            line = raw.split('//')[0].split(';')[0].strip()
+            if not line: continue
+            # label(s)
+            while True:
+                m = re.match(r'^([A-Za-z_.$][\w.$]*):\s*(.*)$', line)
+                if not m: break
+                name, line = m.group(1), m.group(2).strip()
+                if section == 'text':
+                    self.labels[name] = ('t', len(self.instrs))
+                else:
+                    self.labels[name] = ('d', self.DBASE + len(self.mem))
+            if not line: continue
+            m = re.match(r'^([A-Za-z_][\w]*)\s*=\s*\.\s*-\s*([A-Za-z_][\w]*)$', line)
+            if m:
+                self.consts[m.group(1)] = ('len', self.DBASE + len(self.mem), m.group(2)); continue
+            if line.startswith('.'):
+                parts = line.split(None, 1)
+                d = parts[0]; arg = parts[1] if len(parts) > 1 else ''
+                if d in ('.data', '.bss'): section = 'data'; continue
+                if d == '.text': section = 'text'; continue
+                if d in ('.global', '.globl', '.type', '.size', '.section'):
+                    if d == '.section':
+                        section = 'text' if 'text' in arg else 'data'
+                    continue
+                if d in ('.balign', '.align', '.p2align'):
+                    n = int(arg.split(',')[0], 0)
+                    if d != '.balign': n = 1 << n
+                    if section == 'data':
+                        while len(self.mem) % n: self.mem.append(0)
+                    continue
+                if d in ('.quad', '.xword', '.8byte', '.word', '.4byte', '.hword', '.2byte', '.byte'):
+                    size = {'.quad':8, '.xword':8, '.8byte':8, '.word':4, '.4byte':4, '.hword':2, '.2byte':2, '.byte':1}[d]
+                    for v in arg.split(','):
+                        v = v.strip()
+                        if section == 'text':
+                            self.instrs.append(('.data', [v, size], ln)); continue
+                        self.mem += (int(v, 0) & ((1 << (8*size)) - 1)).to_bytes(size, 'little')
+                    continue
+                if d in ('.asciz', '.ascii', '.string'):
+                    s = arg.strip()
+                    assert s[0] == '"' and s[-1] == '"', line
+                    b = bytes(s[1:-1], 'utf-8').decode('unicode_escape').encode('latin-1')
+                    self.mem += b
+                    if d != '.ascii': self.mem.append(0)
+                    continue
+                if d in ('.skip', '.space', '.zero'):
+                    self.mem += bytes(int(arg.split(',')[0], 0)); continue
+                if d == '.ltorg': continue
+                raise Exception('directive ' + line)
+            if section != 'text': raise Exception('instr in data: ' + line)
+            m = re.match(r'^([\w.]+)\s*(.*)$', line)
+            op = m.group(1).lower(); rest = m.group(2)
+            args = self.split_args(rest)
+            self.instrs.append((op, args, ln + 1))
+
+    @staticmethod
+    def split_args(rest):
+        args = []; depth = 0; cur = ''
+        for ch in rest:
+            if ch == '[': depth += 1
+            if ch == ']': depth -= 1
+            if ch == ',' and depth == 0:
+                args.append(cur.strip()); cur = ''
+            else:
+                cur += ch
+        if cur.strip(): args.append(cur.strip())
+        return args
+
+    def sym(self, name):
+        if name in self.consts:
+            k, end, start = self.consts[name]
+            return end - self.addr(start)
+        return self.addr(name)
+
+    def addr(self, name):
+        k, v = self.labels[name]
+        return self.TBASE + 4 * v if k == 't' else v
+
+    def imm(self, s):
+        s = s.strip()
+        if s.startswith('#'): s = s[1:]
+        s = s.strip()
+        if re.match(r'^-?(0x[0-9a-fA-F]+|\d+)$', s): return int(s, 0)
+        if s.startswith(':lo12:'): return self.sym(s[6:]) & 0xfff
+        return self.sym(s)
+
+    def reg(self, r):
+        r = r.strip().lower()
+        if r in ('xzr', 'wzr'): return 0
+        if r == 'sp': return self.sp
+        if r == 'fp': return self.x[29]
+        if r == 'lr': return self.x[30]
+        if r[0] == 'w': return self.x[int(r[1:])] & 0xffffffff
+        return self.x[int(r[1:])]
+
+    def setreg(self, r, v):
+        r = r.strip().lower()
+        if r in ('xzr', 'wzr'): return
+        if r == 'sp': self.sp = v & M64; return
+        if r == 'fp': self.x[29] = v & M64; return
+        if r == 'lr': self.x[30] = v & M64; return
+        if r[0] == 'w': self.x[int(r[1:])] = v & 0xffffffff; return
+        self.x[int(r[1:])] = v & M64
+
+    def isreg(self, s):
+        s = s.strip().lower()
+        return bool(re.match(r'^(x\d+|w\d+|sp|fp|lr|xzr|wzr)$', s))
+
+    def operand2(self, args):
+        # value of args[0] possibly with shift args[1]
+        a = args[0]
+        v = self.reg(a) if self.isreg(a) else self.imm(a) & M64
+        if len(args) > 1:
+            sh = args[1].split()
+            kind = sh[0].lower(); amt = self.imm(sh[1])
+            if kind == 'lsl': v = (v << amt) & M64
+            elif kind == 'lsr': v = v >> amt
+            elif kind == 'asr': v = (s64(v) >> amt) & M64
+        return v
+
+    # memory
+    def load(self, a, n):
+        if self.DBASE <= a < self.DBASE + len(self.mem):
+            o = a - self.DBASE
+            return int.from_bytes(self.mem[o:o+n], 'little')
+        if self.STACKLO <= a < self.STACKHI:
+            o = a - self.STACKLO
+            return int.from_bytes(self.stack[o:o+n], 'little')
+        if self.TBASE <= a < self.TBASE + 4 * len(self.instrs):
+            ins = self.instrs[(a - self.TBASE) // 4]
+            assert ins[0] == '.data'
+            return self.imm(ins[1][0]) & ((1 << (8*n)) - 1)
+        raise Exception('bad load %x' % a)
+
+    def store(self, a, n, v):
+        b = (v & ((1 << (8*n)) - 1)).to_bytes(n, 'little')
+        if self.DBASE <= a < self.DBASE + len(self.mem):
+            o = a - self.DBASE; self.mem[o:o+n] = b; return
+        if self.STACKLO <= a < self.STACKHI:
+            o = a - self.STACKLO; self.stack[o:o+n] = b; return
+        raise Exception('bad store %x' % a)
+
+    def memop(self, a):
+        # returns (address, writeback_reg, new_base) for [base, #off]{!} or [base], #off
+        a = a.strip()
+        m = re.match(r'^\[([^\]]+)\](!?)$', a)
+        parts = [p.strip() for p in m.group(1).split(',')]
+        base = self.reg(parts[0])
+        off = 0
+        if len(parts) > 1:
+            if self.isreg(parts[1]):
+                off = self.reg(parts[1])
+                if len(parts) > 2:
+                    sh = parts[2].split(); off = off << self.imm(sh[1])
+            else:
+                off = self.imm(parts[1])
+        ea = (base + off) & M64
+        return ea, parts[0], (ea if m.group(2) else None)
+
+    def cond(self, c):
+        n, z, cf, v = self.flags
+        return {
+            'eq': z, 'ne': not z, 'cs': cf, 'hs': cf, 'cc': not cf, 'lo': not cf,
+            'mi': n, 'pl': not n, 'vs': v, 'vc': not v,
+            'hi': cf and not z, 'ls': not cf or z,
+            'ge': n == v, 'lt': n != v, 'gt': (not z) and n == v, 'le': z or n != v,
+            'al': True}[c]
+
+    def setflags_sub(self, a, b):
+        r = (a - b) & M64
+        n = r >> 63 == 1; z = r == 0; c = a >= b
+        v = ((a ^ b) & (a ^ r)) >> 63 == 1
+        self.flags = (n, z, c, v)
+
+    def setflags_add(self, a, b):
+        r = (a + b) & M64
+        n = r >> 63 == 1; z = r == 0; c = (a + b) > M64
+        v = ((~(a ^ b)) & (a ^ r)) >> 63 & 1 == 1
+        self.flags = (n, z, c, v)
+
+    def run(self, maxsteps=10_000_000, entry='_start'):
+        self.x = [0] * 31
+        self.STACKHI = 0x7ff0000; self.STACKLO = self.STACKHI - (1 << 20)
+        self.stack = bytearray(1 << 20)
+        self.sp = self.STACKHI
+        self.flags = (False, False, False, False)
+        self.out = bytearray()
+        pc = self.labels[entry][1]
+        steps = 0
+        while steps < maxsteps:
+            steps += 1
+            op, args, ln = self.instrs[pc]
+            npc = pc + 1
+            try:
+                if op == 'mov':
+                    if self.isreg(args[1]): self.setreg(args[0], self.reg(args[1]))
+                    else: self.setreg(args[0], self.imm(args[1]))
+                elif op in ('movz', 'movk', 'movn'):
+                    v = self.imm(args[1]); sh = 0
+                    if len(args) > 2: sh = self.imm(args[2].split()[1])
+                    if op == 'movz': self.setreg(args[0], v << sh)
+                    elif op == 'movn': self.setreg(args[0], ~(v << sh))
+                    else:
+                        old = self.reg(args[0]); mask = 0xffff << sh
+                        self.setreg(args[0], (old & ~mask) | (v << sh))
+                elif op in ('add', 'sub', 'adds', 'subs', 'and', 'orr', 'eor', 'ands', 'bic'):
+                    a = self.reg(args[1]); b = self.operand2(args[2:])
+                    if op in ('add', 'adds'): r = a + b
+                    elif op in ('sub', 'subs'): r = a - b
+                    elif op in ('and', 'ands'): r = a & b
+                    elif op == 'orr': r = a | b
+                    elif op == 'bic': r = a & ~b
+                    else: r = a ^ b
+                    if op == 'subs': self.setflags_sub(a & M64, b & M64)
+                    if op == 'adds': self.setflags_add(a & M64, b & M64)
+                    if op == 'ands':
+                        rr = r & M64; self.flags = (rr >> 63 == 1, rr == 0, False, False)
+                    self.setreg(args[0], r)
+                elif op == 'cmp':
+                    self.setflags_sub(self.reg(args[0]), self.operand2(args[1:]) & M64)
+                elif op == 'cmn':
+                    self.setflags_add(self.reg(args[0]), self.operand2(args[1:]) & M64)
+                elif op == 'tst':
+                    r = self.reg(args[0]) & self.operand2(args[1:]); self.flags = (r >> 63 == 1, r == 0, False, False)
+                elif op in ('lsl', 'lsr', 'asr'):
+                    a = self.reg(args[1]); b = self.reg(args[2]) & 63 if self.isreg(args[2]) else self.imm(args[2])
+                    if op == 'lsl': r = a << b
+                    elif op == 'lsr': r = a >> b
+                    else: r = s64(a) >> b
+                    self.setreg(args[0], r)
+                elif op == 'mul':
+                    self.setreg(args[0], self.reg(args[1]) * self.reg(args[2]))
+                elif op == 'madd':
+                    self.setreg(args[0], self.reg(args[3]) + self.reg(args[1]) * self.reg(args[2]))
+                elif op == 'msub':
+                    self.setreg(args[0], self.reg(args[3]) - self.reg(args[1]) * self.reg(args[2]))
+                elif op == 'smulh':
+                    self.setreg(args[0], (s64(self.reg(args[1])) * s64(self.reg(args[2]))) >> 64)
+                elif op == 'umulh':
+                    self.setreg(args[0], (self.reg(args[1]) * self.reg(args[2])) >> 64)
+                elif op == 'sdiv':
+                    a = s64(self.reg(args[1])); b = s64(self.reg(args[2]))
+                    if b == 0: r = 0
+                    else:
+                        q = abs(a) // abs(b)
+                        r = q if (a >= 0) == (b > 0) else -q
+                    self.setreg(args[0], r)
+                elif op == 'udiv':
+                    a = self.reg(args[1]); b = self.reg(args[2])
+                    self.setreg(args[0], 0 if b == 0 else a // b)
+                elif op == 'neg':
+                    self.setreg(args[0], -self.operand2(args[1:]))
+                elif op == 'mvn':
+                    self.setreg(args[0], ~self.reg(args[1]))
+                elif op == 'adr':
+                    self.setreg(args[0], self.addr(args[1]))
+                elif op == 'adrp':
+                    self.setreg(args[0], self.addr(args[1]) & ~0xfff)
+                elif op in ('ldr', 'str', 'ldrb', 'strb', 'ldrh', 'strh', 'ldrsw'):
+                    n = 1 if op.endswith('b') else 2 if op.endswith('h') else 4 if op == 'ldrsw' else (4 if args[0].lower().startswith('w') else 8)
+                    if op == 'ldr' and args[1].startswith('='):
+                        self.setreg(args[0], self.imm(args[1][1:]))
+                    elif op == 'ldr' and not args[1].startswith('['):
+                        self.setreg(args[0], self.load(self.addr(args[1]), n))
+                    else:
+                        ea, basereg, wb = self.memop(args[1])
+                        post = None
+                        if len(args) > 2:  # post-index
+                            post = self.imm(args[2]); m = re.match(r'^\[([^\]]+)\]$', args[1].strip())
+                            ea = self.reg(basereg)
+                        if op.startswith('ldr'):
+                            v = self.load(ea, n)
+                            if op == 'ldrsw': v = s64(v << 32) >> 32
+                            self.setreg(args[0], v)
+                        else:
+                            self.store(ea, n, self.reg(args[0]))
+                        if wb is not None: self.setreg(basereg, wb)
+                        if post is not None: self.setreg(basereg, ea + post)
+                elif op in ('stp', 'ldp'):
+                    ea, basereg, wb = self.memop(args[2])
+                    post = None
+                    if len(args) > 3:
+                        post = self.imm(args[3]); ea = self.reg(basereg)
+                    if op == 'stp':
+                        self.store(ea, 8, self.reg(args[0])); self.store(ea + 8, 8, self.reg(args[1]))
+                    else:
+                        a0 = self.load(ea, 8); a1 = self.load(ea + 8, 8)
+                        self.setreg(args[0], a0); self.setreg(args[1], a1)
+                    if wb is not None: self.setreg(basereg, wb)
+                    if post is not None: self.setreg(basereg, ea + post)
+                elif op == 'b':
+                    npc = self.labels[args[0]][1]
+                elif op.startswith('b.') or op in ('beq','bne','blt','ble','bgt','bge','bhi','bls','bhs','blo','bmi','bpl','bcs','bcc'):
+                    c = op[2:] if op.startswith('b.') else op[1:]
+                    if self.cond(c): npc = self.labels[args[0]][1]
+                elif op == 'bl':
+                    self.x[30] = self.TBASE + 4 * (pc + 1)
+                    npc = self.labels[args[0]][1]
+                elif op in ('br', 'blr'):
+                    t = self.reg(args[0])
+                    if op == 'blr': self.x[30] = self.TBASE + 4 * (pc + 1)
+                    npc = (t - self.TBASE) // 4
+                elif op == 'ret':
+                    npc = (self.reg(args[0] if args else 'x30') - self.TBASE) // 4
+                elif op in ('cbz', 'cbnz'):
+                    v = self.reg(args[0])
+                    if (v == 0) == (op == 'cbz'): npc = self.labels[args[1]][1]
+                elif op in ('tbz', 'tbnz'):
+                    bit = (self.reg(args[0]) >> self.imm(args[1])) & 1
+                    if (bit == 0) == (op == 'tbz'): npc = self.labels[args[2]][1]
+                elif op in ('csel', 'csinc', 'csneg', 'csinv'):
+                    c = self.cond(args[3].lower())
+                    a = self.reg(args[1]); b = self.reg(args[2])
+                    if op == 'csinc': b = b + 1
+                    elif op == 'csneg': b = -b
+                    elif op == 'csinv': b = ~b
+                    self.setreg(args[0], a if c else b)
+                elif op in ('cset', 'csetm'):
+                    v = 1 if self.cond(args[1].lower()) else 0
+                    self.setreg(args[0], -v if op == 'csetm' else v)
+                elif op == 'svc':
+                    num = self.x[8]
+                    if num == 64:
+                        a = self.x[1]; n = self.x[2]
+                        self.out += bytes(self.load(a + i, 1) for i in range(n))
+                        self.x[0] = n
+                    elif num == 29:
+                        self.x[0] = 0 if os.environ.get('EMU_TTY') else (-25 & M64)
+                    elif num == 93:
+                        return self.x[0] & 0xff, steps
+                    else:
+                        raise Exception('svc %d' % num)
+                elif op == 'nop':
+                    pass
+                else:
+                    raise Exception('unknown op ' + op)
+            except Exception as e:
+                raise Exception('line %d: %s %s: %s' % (ln, op, args, e))
+            pc = npc
+        return None, steps
+
+if __name__ == '__main__':
+    e = Emu(open(sys.argv[1]).read())
+    maxs = int(sys.argv[2]) if len(sys.argv) > 2 else 10_000_000
+    try:
+        code, steps = e.run(maxs)
+    except Exception as error:
+        sys.stderr.write('aarch64_emu: %s\n' % error)
+        sys.exit(125)
+    sys.stdout.buffer.write(bytes(e.out))
+    sys.stdout.flush()
+    if code is None:
+        sys.stderr.write('aarch64_emu: no exit after %d steps\n' % steps)
+        sys.exit(124)
+    sys.exit(code)
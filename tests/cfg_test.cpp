@@ -0,0 +1,73 @@
+#include <iostream>
+#include <vector>
+
+#include "../src/cfg.h"
+
+using namespace std;
+
+// Control flow graph test :
+/*
+	The code generator flushes the main code every FLUSH_SIZE instructions,
+	so a list can end in a branch to a label in the next list, which the
+	graph knows nothing about. Those branches have to survive optimize, while
+	a b to the block that really does come next still goes.
+*/
+
+int failures = 0;
+
+// Number of instructions in code with op and label
+int countBranches(const vector<Instr>& code, OPCODE op, int label) {
+	int found = 0;
+	for (const Instr& instr : code) {
+		if (instr.op == op && instr.label == label) found++;
+	}
+	return found;
+}
+
+// start: cbz x9, middle / mov x10, x11 / middle: mov x12, x13 / <last>
+vector<Instr> threeBlocks(NameTable& labels, Instr last) {
+	Instr skip = makeLabelInstr(OP_CBZ, labels.insert("middle"));
+	skip.rn = 9;
+
+	return {
+		makeLabelInstr(OP_LABEL, labels.insert("start")),
+		skip,
+		makeInstr(OP_MOV, 10, 11),
+		makeLabelInstr(OP_LABEL, labels.insert("middle")),
+		makeInstr(OP_MOV, 12, 13),
+		last
+	};
+}
+
+void check(const char* name, int kept, int expected) {
+	if (kept != expected) {
+		cerr << name << ": " << kept << " branches left, expected " << expected << endl;
+		failures++;
+	}
+}
+
+int main() {
+	NameTable labels;
+	ControlFlowGraph graph(labels);
+
+	int other = labels.insert("other"); // only defined in a later list
+	vector<Instr> code = threeBlocks(labels, makeLabelInstr(OP_B, other));
+	graph.optimize(code);
+	check("b to another list", countBranches(code, OP_B, other), 1);
+
+	Instr conditional = makeLabelInstr(OP_BCOND, other);
+	conditional.cond = COND_EQ;
+	code = threeBlocks(labels, conditional);
+	graph.optimize(code);
+	check("b.eq to another list", countBranches(code, OP_BCOND, other), 1);
+
+	int after = labels.insert("after"); // b to the label straight after it goes
+	code = threeBlocks(labels, makeInstr(OP_MOV, 14, 15));
+	code.insert(code.end() - 2, makeLabelInstr(OP_B, after));
+	code.insert(code.end() - 2, makeLabelInstr(OP_LABEL, after));
+	graph.optimize(code);
+	check("b to the next block", countBranches(code, OP_B, after), 0);
+
+	cout << "cfg: " << failures << " failures" << endl;
+	return failures != 0;
+}
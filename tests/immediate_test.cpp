@@ -0,0 +1,145 @@
+#include <iostream>
+#include <vector>
+#include <climits>
+
+#include "../src/immediate.h"
+#include "../src/encoder.h"
+
+using namespace std;
+
+// Immediate test :
+/*
+	Builds every constant in a corpus of awkward values with immediateInstrs,
+	encodes the instructions and works out what they leave in the register
+	from the machine code alone, decoding bitmasks the way the architecture
+	manual does. Every bitmask pattern (each element size, number of ones and
+	rotation) is also checked to be found by logicalImmediate, and to take a
+	single orr.
+*/
+
+int failures = 0;
+
+// DecodeBitMasks from the manual, for the 64 bit register
+unsigned long long decodeBitmask(unsigned n, unsigned immr, unsigned imms) {
+	unsigned combined = (n << 6) | (~imms & 0x3f);
+	int length = 31 - __builtin_clz(combined);
+	int size = 1 << length;
+	unsigned levels = size - 1;
+	unsigned s = imms & levels;
+	unsigned r = immr & levels;
+
+	unsigned long long element = (s + 1 == 64) ? ~0ULL : (1ULL << (s + 1)) - 1;
+	if (r != 0) element = ((element >> r) | (element << (size - r))) & ((size == 64) ? ~0ULL : (1ULL << size) - 1);
+
+	unsigned long long value = 0;
+	for (int i = 0; i < 64; i += size) value |= element << i;
+	return value;
+}
+
+// Runs the machine code of movz, movn, movk and orr with xzr, returns the register
+unsigned long long evaluate(const vector<unsigned>& words) {
+	unsigned long long reg = 0xdeadbeefdeadbeefULL; // movk keeps what's there, so start with junk
+
+	for (unsigned word : words) {
+		unsigned long long part = (word >> 5) & 0xffff;
+		int shift = ((word >> 21) & 3) * 16;
+
+		if ((word & 0xff800000) == 0xd2800000) reg = part << shift;
+		else if ((word & 0xff800000) == 0x92800000) reg = ~(part << shift);
+		else if ((word & 0xff800000) == 0xf2800000) reg = (reg & ~(0xffffULL << shift)) | (part << shift);
+		else if ((word & 0xff8003e0) == 0xb20003e0) reg = decodeBitmask((word >> 22) & 1, (word >> 16) & 0x3f, (word >> 10) & 0x3f);
+		else {
+			cerr << "unexpected instruction " << hex << word << dec << endl;
+			failures++;
+		}
+	}
+	return reg;
+}
+
+void check(unsigned long long value) {
+	vector<Instr> instrs;
+	immediateInstrs(3, value, instrs);
+
+	vector<unsigned> words;
+	for (const Instr& instr : instrs) {
+		unsigned word;
+		if (!encodeInstr(instr, word)) {
+			cerr << hex << value << dec << ": an instruction can't be encoded" << endl;
+			failures++;
+			return;
+		}
+		if ((word & 0x1f) != 3) {
+			cerr << hex << value << dec << ": wrong register" << endl;
+			failures++;
+		}
+		words.push_back(word);
+	}
+
+	unsigned long long result = evaluate(words);
+	if (result != value || instrs.empty() || instrs.size() > 4) {
+		cerr << hex << value << " built as " << result << dec << " in " << instrs.size() << " instructions" << endl;
+		failures++;
+	}
+}
+
+int main() {
+	vector<unsigned long long> corpus = {0, ~0ULL, (unsigned long long) LLONG_MIN, LLONG_MAX, 1, 0xffff, 0x10000, 0xffff0000ffff0000ULL, 0x123456789abcdef0ULL, 0xfedcba9876543210ULL};
+
+	for (int k = 0; k < 64; k++) { // powers of two, either side of them and their negatives
+		unsigned long long power = 1ULL << k;
+		for (unsigned long long value : {power, power - 1, power + 1, 0 - power, 0 - power - 1, 0 - power + 1}) corpus.push_back(value);
+	}
+
+	unsigned parts[] = {0, 0xffff, 0x1234, 0x8000, 0x7fff, 0x0001};
+	for (unsigned a : parts) { // every mix of chunks that are free for movz, movn or neither
+		for (unsigned b : parts) {
+			for (unsigned c : parts) {
+				for (unsigned d : parts) corpus.push_back((unsigned long long) a << 48 | (unsigned long long) b << 32 | (unsigned long long) c << 16 | d);
+			}
+		}
+	}
+
+	int bitmasks = 0;
+	for (int size = 2; size <= 64; size *= 2) { // every bitmask immediate there is
+		for (int ones = 1; ones < size; ones++) {
+			for (int rotation = 0; rotation < size; rotation++) {
+				unsigned n = (size == 64) ? 1 : 0;
+				unsigned imms = ((~(size - 1) << 1) | (ones - 1)) & 0x3f;
+				unsigned long long value = decodeBitmask(n, rotation, imms);
+
+				unsigned encoding;
+				if (!logicalImmediate(value, encoding) || decodeBitmask(encoding >> 12, (encoding >> 6) & 0x3f, encoding & 0x3f) != value) {
+					cerr << hex << value << dec << ": bitmask (size " << size << ", " << ones << " ones, rotated " << rotation << ") not found" << endl;
+					failures++;
+				}
+
+				vector<Instr> instrs;
+				immediateInstrs(3, value, instrs);
+				if (instrs.size() != 1) {
+					cerr << hex << value << dec << ": bitmask takes " << instrs.size() << " instructions" << endl;
+					failures++;
+				}
+
+				corpus.push_back(value);
+				corpus.push_back(value ^ 0x5a5a0000ULL); // a bitmask with one chunk changed
+				bitmasks++;
+			}
+		}
+	}
+
+	if (bitmasks != 5334) {
+		cerr << bitmasks << " bitmask patterns, there are 5334" << endl;
+		failures++;
+	}
+
+	unsigned encoding;
+	if (logicalImmediate(0, encoding) || logicalImmediate(~0ULL, encoding)) {
+		cerr << "0 and ~0 aren't bitmask immediates" << endl;
+		failures++;
+	}
+
+	for (unsigned long long value : corpus) check(value);
+
+	cout << corpus.size() << " constants, " << failures << " failures" << endl;
+	return failures != 0;
+}
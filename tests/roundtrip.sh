@@ -0,0 +1,87 @@
+#!/bin/sh
+# Checks that the object -c writes is the one the assembler makes from the
+# assembly output. Each program is compiled both ways, the assembly goes
+# through llvm-mc, and the two objects' disassembly (with relocations) and
+# .text and .data contents have to match.
+#
+# usage: tests/roundtrip.sh [compiler] [program.sim ...]
+# With no programs it checks the ones in tests/programs. Without a compiler
+# it builds one. Needs llvm-mc and llvm-objdump, and skips when they're missing.
+#
+# Two differences are expected and taken out first:
+#  - the functions start 8 byte aligned in the object, so .balign 8 is added
+#    after the main code's literal pool
+#  - llvm-mc numbers its mapping symbols $x.1, $d.2, ... the object has them
+#    all as $x and $d
+# llvm-mc keeps a copy of a label's address in a literal pool for every ldr
+# of it, where the object keeps one, so programs that load the same label
+# twice before a .ltorg are skipped.
+
+TESTS=$(cd "$(dirname "$0")" && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+if ! command -v llvm-mc > /dev/null || ! command -v llvm-objdump > /dev/null; then
+	echo "roundtrip: skipped, llvm-mc and llvm-objdump are needed"
+	exit 0
+fi
+
+if [ $# -gt 0 ] && [ -x "$1" ] && [ "${1%.sim}" = "$1" ]; then
+	cp "$1" "$WORK/compiler"
+	shift
+else
+	${CXX:-g++} -std=c++17 -O2 -o "$WORK/compiler" "$TESTS/../src/main.cpp" || exit 1
+fi
+
+if [ $# -eq 0 ]; then
+	set -- "$TESTS"/programs/*.sim
+fi
+
+failed=0
+same=0
+skipped=0
+
+# disassemble <object>: the disassembly and the .text and .data bytes, without the file name
+disassemble() {
+	llvm-objdump -d -r --no-show-raw-insn "$1" | sed 1,3d | sed 's/\$\([xd]\)\.[0-9]*/$\1/g'
+	llvm-objdump -s -j .text -j .data "$1" | sed 1,3d
+}
+
+for program in "$@"; do
+	name=$(basename "$program" .sim)
+	cp "$program" "$WORK/$name.sim"
+
+	if ! (cd "$WORK" && ./compiler "$name.sim" "$name.s" > /dev/null && ./compiler -c "$name.sim" "$name.o" > /dev/null); then
+		echo "FAIL $name: didn't compile"
+		failed=$((failed + 1))
+		continue
+	fi
+
+	shared=$(awk '/^\.ltorg/ { delete seen } /^ldr .*, =[A-Za-z_]/ { sub(/.*=/, ""); if (seen[$0]++) { print; exit } }' "$WORK/$name.s")
+	if [ -n "$shared" ]; then
+		echo "skip $name: $shared is loaded twice from one literal pool"
+		skipped=$((skipped + 1))
+		continue
+	fi
+
+	awk '{ print } /^\.ltorg/ && !aligned { print ".balign 8"; aligned = 1 }' "$WORK/$name.s" > "$WORK/$name.mc.s"
+	if ! llvm-mc -triple=aarch64-linux-gnu -filetype=obj "$WORK/$name.mc.s" -o "$WORK/$name.mc.o"; then
+		echo "FAIL $name: llvm-mc rejected the assembly"
+		failed=$((failed + 1))
+		continue
+	fi
+
+	disassemble "$WORK/$name.o" > "$WORK/$name.object"
+	disassemble "$WORK/$name.mc.o" > "$WORK/$name.assembled"
+
+	if cmp -s "$WORK/$name.object" "$WORK/$name.assembled"; then
+		same=$((same + 1))
+	else
+		echo "FAIL $name: -c and llvm-mc differ (< -c, > llvm-mc)"
+		diff "$WORK/$name.object" "$WORK/$name.assembled" | head -20
+		failed=$((failed + 1))
+	fi
+done
+
+echo "roundtrip: $same the same, $skipped skipped, $failed failed"
+[ $failed -eq 0 ]
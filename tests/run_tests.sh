@@ -0,0 +1,111 @@
+#!/bin/sh
+# Builds the compiler and checks that every program in programs/ prints exactly
+# what its .expected file holds, after building and running the unit tests,
+# the *_test.cpp files here, which test parts of the compiler on their own.
+# The peephole optimizer's -v counts for the same programs are checked
+# against peephole.counts, and roundtrip.sh compares their -c objects with
+# what llvm-mc makes of the assembly. On an AArch64 host the programs are built with
+# --exe and run, elsewhere with qemu-aarch64 if it's there, and otherwise the
+# assembly output is run by aarch64_emu.py.
+#
+# usage: tests/run_tests.sh        (CXX picks the compiler, g++ by default)
+
+TESTS=$(cd "$(dirname "$0")" && pwd)
+ROOT=$(dirname "$TESTS")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+CXX=${CXX:-g++}
+CXXFLAGS=${CXXFLAGS:--std=c++17 -O2}
+
+echo "Building the compiler"
+$CXX $CXXFLAGS -o "$WORK/compiler" "$ROOT/src/main.cpp" || exit 1
+
+failed=0
+passed=0
+
+for test in "$TESTS"/*_test.cpp; do
+	name=$(basename "$test" .cpp)
+	if $CXX $CXXFLAGS -o "$WORK/$name" "$test" && "$WORK/$name"; then
+		passed=$((passed + 1))
+	else
+		echo "FAIL $name"
+		failed=$((failed + 1))
+	fi
+done
+
+if [ "$(uname -m)" = "aarch64" ]; then
+	RUNNER=native
+elif command -v qemu-aarch64 > /dev/null; then
+	RUNNER=qemu
+else
+	RUNNER=emulator
+fi
+echo "Running programs with: $RUNNER"
+
+# run <program.sim> <output>: compiles the program and runs it, its output going to <output>
+run() {
+	name=$(basename "$1" .sim)
+	cp "$1" "$WORK/$name.sim"
+	case $RUNNER in
+		native)
+			(cd "$WORK" && ./compiler --exe "$name.sim" "$name" > /dev/null) || return 1
+			"$WORK/$name" > "$2"
+			;;
+		qemu)
+			(cd "$WORK" && ./compiler --exe "$name.sim" "$name" > /dev/null) || return 1
+			qemu-aarch64 "$WORK/$name" > "$2"
+			;;
+		emulator)
+			(cd "$WORK" && ./compiler "$name.sim" "$name.s" > /dev/null) || return 1
+			python3 "$TESTS/aarch64_emu.py" "$WORK/$name.s" > "$2"
+			;;
+	esac
+}
+
+for program in "$TESTS"/programs/*.sim; do
+	name=$(basename "$program" .sim)
+	if run "$program" "$WORK/$name.out" && cmp -s "$WORK/$name.out" "$TESTS/programs/$name.expected"; then
+		passed=$((passed + 1))
+	else
+		echo "FAIL $name"
+		printf "  expected: %s\n" "$(od -An -c "$TESTS/programs/$name.expected" | tr -s ' \n' ' ' | head -c 300)"
+		printf "  got:      %s\n" "$(od -An -c "$WORK/$name.out" 2> /dev/null | tr -s ' \n' ' ' | head -c 300)"
+		failed=$((failed + 1))
+	fi
+done
+
+# The peephole optimizer has to leave each program with no more instructions
+# than peephole.counts records, and every rule has to fire somewhere
+reports=""
+while read name before after; do
+	report=$(cd "$WORK" && ./compiler -v "$name.sim" "$name.s")
+	now=$(echo "$report" | awk '/^peephole: / { print $5 }')
+	if [ "${now:-0}" -gt "$after" ] || [ -z "$now" ]; then
+		echo "FAIL peephole $name: ${now:-no} instructions left, expected at most $after"
+		failed=$((failed + 1))
+	else
+		passed=$((passed + 1))
+	fi
+	reports="$reports$report
+"
+done < "$TESTS/peephole.counts"
+
+echo "$reports" | awk '
+	/^peephole [a-z-]+: / { sub(":", "", $2); hits[$2] += $3 }
+	/^peephole: / { before += $2; after += $5 }
+	END {
+		for (rule in hits) if (hits[rule] == 0) print "FAIL peephole rule " rule " never fired"
+		printf "peephole: %d instructions in, %d out\n", before, after
+	}' > "$WORK/peephole"
+cat "$WORK/peephole"
+failed=$((failed + $(grep -c "^FAIL" "$WORK/peephole")))
+
+if "$TESTS/roundtrip.sh" "$WORK/compiler"; then
+	passed=$((passed + 1))
+else
+	failed=$((failed + 1))
+fi
+
+echo "$passed passed, $failed failed"
+[ $failed -eq 0 ]
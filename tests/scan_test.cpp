@@ -0,0 +1,100 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <random>
+
+#include "../src/scan.h"
+
+using namespace std;
+
+// Scan test :
+/*
+	Runs every scanning kernel the host has against the scalar one, on random
+	buffers of every length from 0 to 100 with the byte it should stop on at
+	each offset in turn, and with no such byte at all. That covers a stop in
+	the first vector, on either side of the 16 and 32 byte steps and in the
+	scalar tail, and the handoff from AVX2 to SSE2 to scalar on what's left.
+	Each buffer is its own allocation of exactly that length, so a kernel
+	reading past the end shows up under a memory checker.
+*/
+
+typedef size_t (*Kernel)(const char* p, size_t n);
+
+struct Family {
+	const char* name;
+	Kernel scalar;
+	vector<pair<const char*, Kernel>> kernels;
+	string stops;		// bytes the kernel stops on
+	string others;		// bytes it goes past
+};
+
+int failures = 0;
+mt19937 rng(12345);
+
+char pick(const string& bytes) {
+	return bytes[rng() % bytes.size()];
+}
+
+// Compares each kernel with the scalar one on the n bytes in buffer
+void check(const Family& family, const vector<char>& buffer, size_t n) {
+	const char* p = n ? buffer.data() : nullptr;
+	size_t expected = family.scalar(p, n);
+
+	for (const auto& kernel : family.kernels) {
+		size_t found = kernel.second(p, n);
+		if (found != expected) {
+			cerr << family.name << " " << kernel.first << ": length " << n << ", stopped at " << found << ", expected " << expected << endl;
+			failures++;
+		}
+	}
+}
+
+void run(const Family& family) {
+	for (size_t n = 0; n <= 100; n++) {
+		for (size_t stop = 0; stop <= n; stop++) { // stop == n: nothing to stop on
+			for (int round = 0; round < 4; round++) {
+				vector<char> buffer(n);
+				for (size_t i = 0; i < stop; i++) buffer[i] = pick(family.others);
+				for (size_t i = stop; i < n; i++) buffer[i] = (i == stop || rng() % 2) ? pick(family.stops) : pick(family.others); // first stop byte, then a mix
+				check(family, buffer, n);
+			}
+		}
+	}
+}
+
+int main() {
+	string blanks = " \t\r";
+	string notBlanks, printable, notStringEnds;
+	for (int c = 1; c < 256; c++) {
+		if (!isBlank((char) c)) notBlanks += (char) c;
+		if (c != '\n') printable += (char) c;
+		if (!isStringEnd((char) c)) notStringEnds += (char) c;
+	}
+
+	Family skip = {"skipBlanks", skipBlanksScalar, {}, notBlanks, blanks};
+	Family newline = {"findNewline", findNewlineScalar, {}, "\n", printable};
+	Family stringEnd = {"findStringEnd", findStringEndScalar, {}, "\"\n\t\r", notStringEnds};
+
+#ifdef SCAN_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2")) {
+		skip.kernels.push_back({"sse2", skipBlanksSSE2});
+		newline.kernels.push_back({"sse2", findNewlineSSE2});
+		stringEnd.kernels.push_back({"sse2", findStringEndSSE2});
+	}
+	if (__builtin_cpu_supports("avx2")) {
+		skip.kernels.push_back({"avx2", skipBlanksAVX2});
+		newline.kernels.push_back({"avx2", findNewlineAVX2});
+		stringEnd.kernels.push_back({"avx2", findStringEndAVX2});
+	}
+#endif
+
+	int kernels = 0;
+	for (const Family* family : {&skip, &newline, &stringEnd}) {
+		run(*family);
+		kernels += family->kernels.size();
+	}
+
+	cout << "scan: " << kernels << " kernels against scalar, " << failures << " failures" << endl;
+	return failures != 0;
+}